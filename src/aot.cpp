@@ -0,0 +1,94 @@
+#include "aot.h"
+#include "movie.h"
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+// Generated files register before main(), so built on first use
+std::vector<AOTModule> &modules() {
+    static std::vector<AOTModule> registered;
+    return registered;
+}
+
+} // namespace
+
+AOT::Registration::Registration(AOTModule const& module) {
+    modules().push_back(module);
+}
+
+AOT::AOT(CHIP8 &chip8) : c{chip8}, quirks{chip8.quirk_flags()} {}
+
+AOTModule const *AOT::find(uint64_t const rom_hash) {
+    for (AOTModule const& module : modules()) {
+        if (module.rom_hash == rom_hash) {
+            return &module;
+        }
+    }
+
+    return nullptr;
+}
+
+void AOT::attach(CHIP8 &chip8) {
+    chip8.aot_blocks.clear();
+
+    // Spare hashing the ROM in builds without any
+    if (modules().empty()) {
+        return;
+    }
+
+    if (AOTModule const *const module {find(Movie::hash_rom(chip8))}) {
+        attach(chip8, *module);
+    }
+}
+
+void AOT::attach(CHIP8 &chip8, AOTModule const& module) {
+    chip8.aot_blocks.assign(0x1000, nullptr);
+
+    for (size_t i {0}; i < module.count; i++) {
+        chip8.aot_blocks[module.blocks[i].start & 0x0FFF] = &module.blocks[i];
+    }
+}
+
+uint64_t AOT::run(CHIP8 &chip8, uint64_t const cycles) {
+    AOT view {chip8};
+    // Counted on the machine, idle loops the interpreter skips count too
+    uint64_t const start {chip8.state.cycles};
+
+    while (chip8.state.cycles - start < cycles) {
+        uint64_t const left {cycles - (chip8.state.cycles - start)};
+        uint16_t const pc {chip8.state.pc};
+        AOTBlock const *const block {pc <= 0x0FFE ? chip8.aot_blocks[pc]
+                                                  : nullptr};
+
+        // Interpret what was not translated and blocks that would overrun
+        if (!block || block->length > left) {
+            chip8.advance_timers();
+            chip8.step();
+            continue;
+        }
+
+        // Only the last instruction of a block looks at the timers
+        for (uint16_t i {0}; i < block->length; i++) {
+            chip8.advance_timers();
+        }
+
+        block->code(view);
+    }
+
+    return chip8.state.cycles - start;
+}
+
+void AOT::invalidate(CHIP8 &chip8, uint16_t const address,
+                     size_t const size) {
+    size_t const end {std::min<size_t>(address + size, 0x1000)};
+    size_t const first {address > 2 * MAX_BLOCK ? address - 2 * MAX_BLOCK : 0};
+
+    for (size_t start {first}; start < end; start++) {
+        AOTBlock const *const block {chip8.aot_blocks[start]};
+
+        if (block && block->start + 2u * block->length > address) {
+            chip8.aot_blocks[start] = nullptr;
+        }
+    }
+}
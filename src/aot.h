@@ -0,0 +1,106 @@
+#include "chip8.h"
+#include "semantics.h"
+#include <cstddef>
+#include <cstdint>
+
+#pragma once
+
+// Runs ROMs translated to C++ ahead of time.
+//
+// chip8-aot follows the control flow of a ROM from 0x200 and writes every
+// basic block as a function of a C++ file, which the chip8_aot() CMake
+// function compiles into a target. The file registers itself at startup,
+// run_rom() picks the blocks of a registered ROM by content and the AOT
+// engine runs them. Blocks end where the JIT's do, so their timer ticks are
+// applied on entry. Indirect jumps, code the translator never reached and
+// code written over at run time go to the interpreter.
+
+class AOT;
+
+struct AOTBlock {
+    uint16_t start;
+    // In instructions
+    uint16_t length;
+    void (*code)(AOT &m);
+};
+
+struct AOTModule {
+    // ROM file the blocks were translated from
+    char const *name;
+    // Movie::hash_rom() of the machine right after loading it
+    uint64_t rom_hash;
+    AOTBlock const *blocks;
+    size_t count;
+};
+
+// Also the machine view the generated code runs execute() against
+class AOT {
+public:
+    using Op = CHIP8::Op;
+    using Instr = CHIP8::Instr;
+
+    // Longest block in instructions
+    static size_t constexpr MAX_BLOCK {32};
+
+    // Made by generated files to add their module before main()
+    struct Registration {
+        explicit Registration(AOTModule const& module);
+    };
+
+    static AOTModule const *find(uint64_t const rom_hash);
+    // Points the machine at the blocks of its ROM, if any are registered
+    static void attach(CHIP8 &chip8);
+    static void attach(CHIP8 &chip8, AOTModule const& module);
+
+    // For the translator
+    static Instr decode(uint16_t const opcode) { return CHIP8::decode(opcode); }
+    static char const *op_name(Op const op) { return CHIP8::op_name(op); }
+
+    static uint64_t run(CHIP8 &chip8, uint64_t const cycles);
+    // Sends blocks compiled from any byte in the range to the interpreter
+    static void invalidate(CHIP8 &chip8, uint16_t const address,
+                           size_t const size);
+
+    template <Op OP>
+    void execute(Instr const& in) {
+        CHIP8::execute<OP>(*this, in);
+
+        // Idle loops are skipped as the interpreters do
+        if constexpr (OP == Op::JP || OP == Op::LD_VX_K) {
+            if (c.run_end) {
+                c.fast_forward();
+            }
+        }
+    }
+
+    uint8_t &V(size_t const i) { return c.state.registers[i]; }
+    uint16_t &pc() { return c.state.pc; }
+    uint16_t &I() { return c.state.I; }
+    uint8_t &sp() { return c.state.sp; }
+    uint16_t &stack(size_t const i) { return c.state.stack[i]; }
+    uint8_t &delay_timer() { return c.state.delay_timer; }
+    uint8_t &sound_timer() { return c.state.sound_timer; }
+    uint64_t &row(size_t const y) { return c.state.display_buffer[y]; }
+    void touch_rows(uint32_t const rows) { c.dirty_rows |= rows; }
+    uint8_t memory(size_t const address) { return c.state.memory[address]; }
+    void write_memory(uint16_t const address, uint8_t const *src,
+                      size_t const size) {
+        c.write_memory(address, src, size);
+    }
+    uint16_t keystates() { return c.keystates; }
+    uint64_t &rng() { return c.state.rng; }
+    uint8_t &vip_random() { return c.state.vip_random; }
+    uint64_t cycles() { return c.state.cycles; }
+    CHIP8::Random random() { return c.random; }
+    bool legacy_jump() { return quirks.jump; }
+    bool legacy_shift() { return quirks.shift; }
+    bool legacy_index_add() { return quirks.index_add; }
+    bool legacy_load_store() { return quirks.load_store; }
+
+private:
+    CHIP8 &c;
+    // As the active profile applies them, fixed for a run
+    CHIP8::QuirkFlags quirks;
+
+    AOT(CHIP8 &chip8);
+};
@@ -0,0 +1,222 @@
+#include "aot.h"
+#include "chip8.h"
+#include "jit.h"
+#include "movie.h"
+#include "trace.h"
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Translates a ROM to C++ for the AOT engine:
+//
+//   chip8-aot <rom> <output.cpp>
+//
+// Control flow is followed from 0x200 through jumps, calls, returns and
+// skips. Jumps through V0 cannot be followed, nor can data the ROM runs as
+// code once written, so those stay with the interpreter.
+
+namespace {
+
+using Op = AOT::Op;
+using Instr = AOT::Instr;
+
+void usage(char const *name) {
+    std::cerr << "Usage: " << name << " <rom> <output.cpp>" << std::endl;
+}
+
+struct Program {
+    uint8_t const *memory;
+    // Reached by following control flow
+    std::vector<bool> code;
+    // Where a block has to start
+    std::vector<bool> leader;
+
+    uint16_t opcode(uint16_t const address) const {
+        return static_cast<uint16_t>(memory[address] << 8 |
+                                     memory[address + 1]);
+    }
+};
+
+void follow(Program &program) {
+    std::vector<uint16_t> pending {0x200};
+    program.leader[0x200] = true;
+
+    auto const branch = [&](uint16_t const target) {
+        if (target <= 0x0FFE) {
+            program.leader[target] = true;
+            pending.push_back(target);
+        }
+    };
+
+    while (!pending.empty()) {
+        uint16_t address {pending.back()};
+        pending.pop_back();
+
+        while (address <= 0x0FFE && !program.code[address]) {
+            program.code[address] = true;
+            Instr const in {AOT::decode(program.opcode(address))};
+            uint16_t const next = address + 2;
+
+            if (in.op == Op::JP) {
+                branch(in.NNN);
+                break;
+            }
+
+            if (in.op == Op::CALL) {
+                branch(in.NNN);
+                branch(next);
+                break;
+            }
+
+            if (in.op == Op::RET || in.op == Op::JP_V0) {
+                break;
+            }
+
+            if (in.op == Op::SE_VX_NN || in.op == Op::SNE_VX_NN ||
+                in.op == Op::SE_VX_VY || in.op == Op::SNE_VX_VY ||
+                in.op == Op::SKP || in.op == Op::SKNP) {
+                branch(next);
+                branch(next + 2);
+                break;
+            }
+
+            // Any other end of a JIT block falls through into a new one
+            if (JIT::ends_block(in.op)) {
+                branch(next);
+                break;
+            }
+
+            address = next;
+        }
+    }
+}
+
+// Addresses of the instructions in the block starting at a leader
+std::vector<uint16_t> block_at(Program const& program, uint16_t const start) {
+    std::vector<uint16_t> block {};
+    uint16_t address {start};
+
+    while (true) {
+        block.push_back(address);
+        Op const op {AOT::decode(program.opcode(address)).op};
+        address += 2;
+
+        if (JIT::ends_block(op) || block.size() == AOT::MAX_BLOCK ||
+            address > 0x0FFE || program.leader[address] ||
+            !program.code[address]) {
+            return block;
+        }
+    }
+}
+
+void write_instruction(std::ostream &os, uint16_t const opcode) {
+    Instr const in {AOT::decode(opcode)};
+    char text[128];
+
+    std::snprintf(text, sizeof(text),
+                  "    m.execute<Op::%s>({Op::%s, 0x%X, 0x%X, 0x%X, 0x%02X, "
+                  "0x%03X});\n",
+                  AOT::op_name(in.op), AOT::op_name(in.op), in.X, in.Y, in.N,
+                  in.NN, in.NNN);
+    os << text;
+}
+
+void write_module(std::ostream &os, Program const& program,
+                  std::string const& name, uint64_t const rom_hash) {
+    os << "// Translated from " << name << " by chip8-aot, do not edit\n"
+       << "#include \"aot.h\"\n"
+       << "#include <iterator>\n\n"
+       << "namespace {\n\n"
+       << "using Op = AOT::Op;\n";
+
+    std::vector<std::pair<uint16_t, size_t>> blocks {};
+    char text[128];
+
+    for (uint16_t start {0}; start <= 0x0FFE; start++) {
+        if (!program.leader[start] || !program.code[start]) {
+            continue;
+        }
+
+        std::vector<uint16_t> const block {block_at(program, start)};
+        blocks.emplace_back(start, block.size());
+
+        std::snprintf(text, sizeof(text), "\nvoid block_%03X(AOT &m) {\n",
+                      start);
+        os << text;
+
+        for (size_t i {0}; i < block.size(); i++) {
+            uint16_t const opcode {program.opcode(block[i])};
+            std::snprintf(text, sizeof(text), "    // 0x%03X  %s\n", block[i],
+                          disassemble(opcode).c_str());
+            os << text;
+
+            // Instructions see the pc past themselves, only the last one
+            // can read or change it
+            if (i + 1 == block.size()) {
+                std::snprintf(text, sizeof(text), "    m.pc() = 0x%03X;\n",
+                              block[i] + 2);
+                os << text;
+            }
+
+            write_instruction(os, opcode);
+        }
+
+        os << "}\n";
+    }
+
+    os << "\nAOTBlock const BLOCKS[] {\n";
+
+    for (auto const& [start, length] : blocks) {
+        std::snprintf(text, sizeof(text), "    {0x%03X, %zu, block_%03X},\n",
+                      start, length, start);
+        os << text;
+    }
+
+    std::snprintf(text, sizeof(text), "0x%016llXULL",
+                  static_cast<unsigned long long>(rom_hash));
+
+    os << "};\n\n"
+       << "AOT::Registration const registration {\n"
+       << "    {\"" << name << "\", " << text
+       << ", BLOCKS, std::size(BLOCKS)}\n"
+       << "};\n\n"
+       << "} // namespace\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::string const path {argv[1]};
+    CHIP8 chip8 {};
+
+    if (!chip8.run_rom(path)) {
+        return 1;
+    }
+
+    CHIP8::State state {};
+    chip8.save_state(state);
+
+    Program program {state.memory, std::vector<bool>(0x1000),
+                     std::vector<bool>(0x1000)};
+    follow(program);
+
+    std::string const name {path.substr(path.find_last_of("/\\") + 1)};
+    std::ofstream ofs(argv[2]);
+
+    if (!ofs) {
+        std::cerr << "Could not create " << argv[2] << std::endl;
+        return 1;
+    }
+
+    write_module(ofs, program, name, Movie::hash_rom(chip8));
+    return 0;
+}
@@ -0,0 +1,363 @@
+#include "batch.h"
+#include "semantics.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// One lane as a machine view for CHIP8::execute. Holds plain pointers
+// copied out of the batch, so byte stores through them cannot be assumed
+// to change them and loops over lanes stay vectorizable.
+struct CHIP8Batch::Lane {
+    uint8_t *V_;
+    uint16_t *stack_;
+    uint16_t *pc_;
+    uint16_t *I_;
+    uint8_t *sp_;
+    uint8_t *delay_timer_;
+    uint8_t *sound_timer_;
+    uint64_t *rng_;
+    uint8_t *vip_random_;
+    uint64_t *display_buffer_;
+    bool *display_dirty_;
+    uint8_t *const *pages_;
+    // Only for writes, which may copy a page
+    CHIP8Batch *batch_;
+    uint16_t const *keystates_;
+    uint64_t cycles_;
+    size_t lanes;
+    size_t l;
+    bool jump;
+    bool shift;
+    bool index_add;
+    bool load_store;
+    CHIP8::Random random_;
+
+    explicit Lane(CHIP8Batch &b, size_t const l = 0)
+        : V_{b.V.data()},
+          stack_{b.stack.data()},
+          pc_{b.pc.data()},
+          I_{b.I.data()},
+          sp_{b.sp.data()},
+          delay_timer_{b.delay_timer.data()},
+          sound_timer_{b.sound_timer.data()},
+          rng_{b.rng.data()},
+          vip_random_{b.vip_random.data()},
+          display_buffer_{b.display_buffer.data()},
+          display_dirty_{&b.display_dirty},
+          pages_{b.pages.data()},
+          batch_{&b},
+          keystates_{b.keystates.data()},
+          cycles_{b.cycles},
+          lanes{b.lanes},
+          l{l},
+          jump{b.USE_LEGACY_JUMP},
+          shift{b.USE_LEGACY_SHIFT},
+          index_add{b.USE_LEGACY_INDEX_ADD},
+          load_store{b.USE_LEGACY_LOAD_STORE},
+          random_{b.random} {}
+
+    uint8_t &V(size_t const i) { return V_[i * lanes + l]; }
+    uint16_t &pc() { return pc_[l]; }
+    uint16_t &I() { return I_[l]; }
+    uint8_t &sp() { return sp_[l]; }
+    uint16_t &stack(size_t const i) { return stack_[i * lanes + l]; }
+    uint8_t &delay_timer() { return delay_timer_[l]; }
+    uint8_t &sound_timer() { return sound_timer_[l]; }
+    uint64_t &row(size_t const y) { return display_buffer_[y * lanes + l]; }
+    void touch_rows(uint32_t const rows) { *display_dirty_ |= rows != 0; }
+    uint8_t memory(size_t const address) {
+        size_t const a {address & 0x0FFF};
+        return pages_[a / PAGE_SIZE * lanes + l][a % PAGE_SIZE];
+    }
+    // Checked once per page rather than per byte
+    void write_memory(uint16_t const address, uint8_t const *src,
+                      size_t const size) {
+        for (size_t done {0}; done < size;) {
+            size_t const a {(address + done) & 0x0FFF};
+            size_t const n {std::min(size - done, PAGE_SIZE - a % PAGE_SIZE)};
+            std::memcpy(batch_->own_page(a / PAGE_SIZE, l) + a % PAGE_SIZE,
+                        src + done, n);
+            done += n;
+        }
+    }
+    uint16_t keystates() { return keystates_[l]; }
+    uint64_t &rng() { return rng_[l]; }
+    uint8_t &vip_random() { return vip_random_[l]; }
+    uint64_t cycles() { return cycles_; }
+    CHIP8::Random random() { return random_; }
+    bool legacy_jump() { return jump; }
+    bool legacy_shift() { return shift; }
+    bool legacy_index_add() { return index_add; }
+    bool legacy_load_store() { return load_store; }
+};
+
+CHIP8Batch::CHIP8Batch(CHIP8 const& prototype, size_t const lanes)
+    : USE_LEGACY_JUMP{prototype.USE_LEGACY_JUMP},
+      USE_LEGACY_SHIFT{prototype.USE_LEGACY_SHIFT},
+      USE_LEGACY_INDEX_ADD{prototype.USE_LEGACY_INDEX_ADD},
+      USE_LEGACY_LOAD_STORE{prototype.USE_LEGACY_LOAD_STORE},
+      random{prototype.random},
+      ips{prototype.ips},
+      keystates(lanes, prototype.keystates),
+      lanes{lanes},
+      V(16 * lanes),
+      stack(16 * lanes),
+      pc(lanes),
+      I(lanes),
+      sp(lanes),
+      delay_timer(lanes),
+      sound_timer(lanes),
+      rng(lanes),
+      vip_random(lanes),
+      display(CHIP8::DISPLAY_HEIGHT * lanes),
+      display_buffer(CHIP8::DISPLAY_HEIGHT * lanes),
+      image(PAGES),
+      pages(PAGES * lanes),
+      accum_time{prototype.state.accum_time},
+      frames{prototype.state.frames},
+      cycles{prototype.state.cycles},
+      opcodes(lanes) {
+    std::memcpy(image.data(), prototype.state.memory, PAGES * PAGE_SIZE);
+
+    for (size_t p {0}; p < PAGES; p++) {
+        std::fill_n(&pages[p * lanes], lanes, image[p].data());
+    }
+
+    // Copies nothing, every lane matches the image
+    for (size_t l {0}; l < lanes; l++) {
+        load_state(l, prototype.state);
+    }
+}
+
+size_t CHIP8Batch::size() const {
+    return lanes;
+}
+
+void CHIP8Batch::seed(size_t const lane, uint64_t const seed) {
+    rng[lane] = CHIP8::seeded(seed);
+}
+
+size_t CHIP8Batch::owned_pages() const {
+    return owned.size();
+}
+
+uint8_t *CHIP8Batch::own_page(size_t const page, size_t const lane) {
+    uint8_t *&slot {pages[page * lanes + lane]};
+
+    if (slot == image[page].data()) {
+        owned.push_back(image[page]);
+        slot = owned.back().data();
+    }
+
+    return slot;
+}
+
+void CHIP8Batch::cycle() {
+    advance_timers();
+    step();
+}
+
+uint64_t CHIP8Batch::run(uint64_t const cycles) {
+    for (uint64_t i {0}; i < cycles; i++) {
+        advance_timers();
+        step();
+    }
+
+    return cycles;
+}
+
+void CHIP8Batch::advance_timers() {
+    cycles++;
+
+    // Same clock as CHIP8::advance_timers, once for every lane
+    accum_time += 60.0 / ips;
+    double tick;
+    modf(accum_time, &tick);
+
+    if (tick >= 1) {
+        int const t {static_cast<int>(tick)};
+
+        for (size_t l {0}; l < lanes; l++) {
+            delay_timer[l] = std::max(0, delay_timer[l] - t);
+            sound_timer[l] = std::max(0, sound_timer[l] - t);
+        }
+
+        // Nothing to copy on frames no lane drew in
+        if (display_dirty) {
+            display = display_buffer;
+            display_dirty = false;
+        }
+
+        frames++;
+    }
+
+    accum_time -= tick;
+}
+
+void CHIP8Batch::step() {
+    if (!lanes) {
+        return;
+    }
+
+    Lane lane {*this};
+
+    // Lanes at one address of one page share the opcode, which is then
+    // fetched once. Only compares, so the loop stays vectorizable.
+    uint16_t const address {pc[0]};
+    uint8_t *const *const row {&pages[(address & 0x0FFF) / PAGE_SIZE * lanes]};
+    bool uniform {address % PAGE_SIZE != PAGE_SIZE - 1};
+
+    for (size_t l {0}; l < lanes; l++) {
+        uniform &= (pc[l] == address) & (row[l] == row[0]);
+    }
+
+    if (uniform) {
+        opcodes[0] = static_cast<uint16_t>(lane.memory(address) << 8 |
+                                           lane.memory(address + 1));
+    } else {
+        uniform = true;
+
+        for (size_t l {0}; l < lanes; l++) {
+            lane.l = l;
+            opcodes[l] = static_cast<uint16_t>(lane.memory(pc[l]) << 8 |
+                                               lane.memory(pc[l] + 1));
+            uniform &= opcodes[l] == opcodes[0];
+        }
+    }
+
+    if (uniform) {
+        Instr const in {CHIP8::decode(opcodes[0])};
+        UNIFORM_HANDLERS[static_cast<size_t>(in.op)](*this, in);
+        uniform_cycles++;
+        return;
+    }
+
+    for (size_t l {0}; l < lanes; l++) {
+        Instr const in {CHIP8::decode(opcodes[l])};
+        lane.l = l;
+        LANE_HANDLERS[static_cast<size_t>(in.op)](lane, in);
+    }
+
+    divergent_cycles++;
+}
+
+template <CHIP8::Op OP>
+void CHIP8Batch::exec_uniform(CHIP8Batch &batch, Instr const& in) {
+    // The instruction is the same for every lane, only the data differs
+    Lane lane {batch};
+    size_t const lanes {batch.lanes};
+
+    for (size_t l {0}; l < lanes; l++) {
+        lane.l = l;
+        lane.pc() += 2;
+        CHIP8::execute<OP>(lane, in);
+    }
+}
+
+template <CHIP8::Op OP>
+void CHIP8Batch::exec_lane(Lane lane, Instr const& in) {
+    lane.pc() += 2;
+    CHIP8::execute<OP>(lane, in);
+}
+
+template <size_t... OPS>
+constexpr std::array<CHIP8Batch::UniformHandler, sizeof...(OPS)>
+CHIP8Batch::make_uniform_handlers(std::index_sequence<OPS...>) {
+    return {&CHIP8Batch::exec_uniform<static_cast<Op>(OPS)>...};
+}
+
+template <size_t... OPS>
+constexpr std::array<CHIP8Batch::LaneHandler, sizeof...(OPS)>
+CHIP8Batch::make_lane_handlers(std::index_sequence<OPS...>) {
+    return {&CHIP8Batch::exec_lane<static_cast<Op>(OPS)>...};
+}
+
+std::array<CHIP8Batch::UniformHandler,
+           static_cast<size_t>(CHIP8::Op::COUNT)> const
+CHIP8Batch::UNIFORM_HANDLERS {make_uniform_handlers(
+    std::make_index_sequence<static_cast<size_t>(Op::COUNT)>{})};
+
+std::array<CHIP8Batch::LaneHandler,
+           static_cast<size_t>(CHIP8::Op::COUNT)> const
+CHIP8Batch::LANE_HANDLERS {make_lane_handlers(
+    std::make_index_sequence<static_cast<size_t>(Op::COUNT)>{})};
+
+void CHIP8Batch::save_state(size_t const lane, CHIP8::State &out) const {
+    for (size_t p {0}; p < PAGES; p++) {
+        std::memcpy(out.memory + p * PAGE_SIZE, pages[p * lanes + lane],
+                    PAGE_SIZE);
+    }
+
+    for (size_t i {0}; i < 16; i++) {
+        out.registers[i] = V[i * lanes + lane];
+        out.stack[i] = stack[i * lanes + lane];
+    }
+
+    out.pc = pc[lane];
+    out.I = I[lane];
+    out.sp = sp[lane];
+    out.delay_timer = delay_timer[lane];
+    out.sound_timer = sound_timer[lane];
+    out.accum_time = accum_time;
+    out.frames = frames;
+    out.cycles = cycles;
+    out.rng = rng[lane];
+    out.vip_random = vip_random[lane];
+
+    for (size_t y {0}; y < CHIP8::DISPLAY_HEIGHT; y++) {
+        out.display_buffer[y] = display_buffer[y * lanes + lane];
+    }
+}
+
+void CHIP8Batch::load_state(size_t const lane, CHIP8::State const& in) {
+    // Pages the state leaves as they are stay shared
+    for (size_t p {0}; p < PAGES; p++) {
+        uint8_t const *const src {in.memory + p * PAGE_SIZE};
+
+        if (std::memcmp(pages[p * lanes + lane], src, PAGE_SIZE) != 0) {
+            std::memcpy(own_page(p, lane), src, PAGE_SIZE);
+        }
+    }
+
+    for (size_t i {0}; i < 16; i++) {
+        V[i * lanes + lane] = in.registers[i];
+        stack[i * lanes + lane] = in.stack[i];
+    }
+
+    pc[lane] = in.pc;
+    I[lane] = in.I;
+    sp[lane] = in.sp;
+    delay_timer[lane] = in.delay_timer;
+    sound_timer[lane] = in.sound_timer;
+    rng[lane] = in.rng;
+    vip_random[lane] = in.vip_random;
+
+    // Like CHIP8, the restored screen is presented right away
+    for (size_t y {0}; y < CHIP8::DISPLAY_HEIGHT; y++) {
+        display[y * lanes + lane] = in.display_buffer[y];
+        display_buffer[y * lanes + lane] = in.display_buffer[y];
+    }
+}
+
+bool CHIP8Batch::pixel(size_t const lane, int const x, int const y) const {
+    return (display[y * lanes + lane] >> (CHIP8::DISPLAY_WIDTH - 1 - x)) &
+           0x1;
+}
+
+uint64_t CHIP8Batch::frame_count() const {
+    return frames;
+}
+
+uint64_t CHIP8Batch::frame_hash(size_t const lane) const {
+    // FNV-1a, like CHIP8::frame_hash
+    uint64_t hash {0xCBF29CE484222325};
+
+    for (int y {0}; y < CHIP8::DISPLAY_HEIGHT; y++) {
+        for (int x {0}; x < CHIP8::DISPLAY_WIDTH; x++) {
+            hash ^= pixel(lane, x, y);
+            hash *= 0x100000001B3;
+        }
+    }
+
+    return hash;
+}
@@ -0,0 +1,133 @@
+#include "chip8.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#pragma once
+
+// Runs many copies of one machine in lockstep, one instruction per lane
+// per cycle.
+//
+// Registers, timers and display rows are stored as one array per field with
+// one element per lane. Memory is the prototype's, shared in 256 byte pages
+// until a lane first writes to one and gets a copy of its own, so a lane
+// adds a page table rather than 4 KiB. When every lane is about to run the same
+// opcode, which is the common case for copies of one ROM, the instruction
+// is executed as a single loop across all lanes that the compiler turns
+// into SIMD. Lanes that diverge are stepped one by one. Either way the
+// semantics are the ones every CHIP8 engine uses.
+//
+// All lanes run the same number of cycles, so they share the 60Hz clock.
+class CHIP8Batch {
+public:
+    // Copied from the prototype, may be changed between cycles
+    bool USE_LEGACY_JUMP;
+    bool USE_LEGACY_SHIFT;
+    bool USE_LEGACY_INDEX_ADD;
+    bool USE_LEGACY_LOAD_STORE;
+    CHIP8::Random random;
+    int ips;
+
+    // Pressed keys per lane
+    std::vector<uint16_t> keystates;
+
+    // Every lane starts as a copy of the prototype's machine state
+    CHIP8Batch(CHIP8 const& prototype, size_t const lanes);
+    // Lanes point into the batch's own pages
+    CHIP8Batch(CHIP8Batch const&) = delete;
+    CHIP8Batch& operator=(CHIP8Batch const&) = delete;
+
+    size_t size() const;
+
+    // Restart the PCG generator of one lane
+    void seed(size_t const lane, uint64_t const seed);
+
+    void cycle();
+    // Returns the number of cycles executed, per lane
+    uint64_t run(uint64_t const cycles);
+
+    // The shared clock is not per lane, load_state keeps the batch's
+    // accum_time, frame count and cycle count
+    void save_state(size_t const lane, CHIP8::State &out) const;
+    void load_state(size_t const lane, CHIP8::State const& in);
+
+    bool pixel(size_t const lane, int const x, int const y) const;
+    uint64_t frame_count() const;
+    // Same hash as CHIP8::frame_hash
+    uint64_t frame_hash(size_t const lane) const;
+
+    // Cycles that ran across all lanes at once and lane by lane
+    uint64_t uniform_cycles {0};
+    uint64_t divergent_cycles {0};
+
+    // Pages copied out of the shared image by lanes writing to them
+    size_t owned_pages() const;
+
+private:
+    using Op = CHIP8::Op;
+    using Instr = CHIP8::Instr;
+
+    size_t const lanes;
+
+    // Per register, then per lane
+    std::vector<uint8_t> V;
+    std::vector<uint16_t> stack;
+    std::vector<uint16_t> pc;
+    std::vector<uint16_t> I;
+    std::vector<uint8_t> sp;
+    std::vector<uint8_t> delay_timer;
+    std::vector<uint8_t> sound_timer;
+    std::vector<uint64_t> rng;
+    std::vector<uint8_t> vip_random;
+    // Per row, then per lane
+    std::vector<uint64_t> display;
+    std::vector<uint64_t> display_buffer;
+    // Set when any lane drew since the last frame
+    bool display_dirty {false};
+
+    static size_t constexpr PAGE_SIZE {256};
+    static size_t constexpr PAGES {sizeof(CHIP8::State::memory) / PAGE_SIZE};
+    using Page = std::array<uint8_t, PAGE_SIZE>;
+
+    // Memory of the prototype, never written
+    std::vector<Page> image;
+    // Copies lanes wrote to, a deque never moves them
+    std::deque<Page> owned;
+    // Per page, then per lane, either the image's page or an owned one
+    std::vector<uint8_t *> pages;
+
+    double accum_time;
+    uint64_t frames;
+    uint64_t cycles;
+
+    // Opcode each lane is about to run
+    std::vector<uint16_t> opcodes;
+
+    struct Lane;
+
+    using UniformHandler = void (*)(CHIP8Batch &, Instr const&);
+    using LaneHandler = void (*)(Lane, Instr const&);
+    static std::array<UniformHandler, static_cast<size_t>(Op::COUNT)> const
+        UNIFORM_HANDLERS;
+    static std::array<LaneHandler, static_cast<size_t>(Op::COUNT)> const
+        LANE_HANDLERS;
+
+    template <Op OP>
+    static void exec_uniform(CHIP8Batch &batch, Instr const& in);
+    template <Op OP>
+    static void exec_lane(Lane lane, Instr const& in);
+    template <size_t... OPS>
+    static constexpr std::array<UniformHandler, sizeof...(OPS)>
+    make_uniform_handlers(std::index_sequence<OPS...>);
+    template <size_t... OPS>
+    static constexpr std::array<LaneHandler, sizeof...(OPS)>
+    make_lane_handlers(std::index_sequence<OPS...>);
+
+    // The lane's page, copied out of the image first if it is shared
+    uint8_t *own_page(size_t const page, size_t const lane);
+
+    void advance_timers();
+    void step();
+};
@@ -0,0 +1,418 @@
+#include "chip8.h"
+#include "options.h"
+#include "rewind.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Micro-benchmarks for the core, printed as one JSON document so results
+// can be diffed between releases:
+//
+//   dispatch   ns per instruction for every opcode family through cycle()
+//   tables     bytes each engine dispatches through and ns from a new
+//              machine to its first instruction
+//   draw       ns per DXYN for several sprite heights and clipping cases
+//   snapshot   ns per save, load, serialize, deserialize and rewind push
+//   workloads  instructions per second over whole programs through run(),
+//              counting only executed ones. Cycles idle loops were
+//              fast-forwarded through are reported apart, with whether
+//              the engine skips them at all.
+//
+// Every measurement repeats until it took at least --time seconds.
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+CHIP8::Engine const ENGINES[] {
+    CHIP8::Engine::SWITCH,
+    CHIP8::Engine::CACHED,
+    CHIP8::Engine::THREADED,
+    CHIP8::Engine::JIT,
+    CHIP8::Engine::TABLE,
+    CHIP8::Engine::AOT,
+};
+
+void usage(char const *name) {
+    std::cerr << "Usage: " << name
+              << " [--time SECONDS] [--engine E] [rom...]\n"
+              << "Engines: " << ENGINE_NAMES << std::endl;
+}
+
+struct Settings {
+    double min_time {0.05};
+    std::vector<CHIP8::Engine> engines {std::begin(ENGINES),
+                                        std::end(ENGINES)};
+};
+
+// Calls run(n) with growing n until it takes min_time, returns the
+// seconds per unit of n
+template <typename Run>
+double measure(Settings const& settings, Run &&run) {
+    for (uint64_t n {256};; n *= 2) {
+        auto const start {Clock::now()};
+        run(n);
+        double const elapsed {
+            std::chrono::duration<double>(Clock::now() - start).count()};
+
+        if (elapsed >= settings.min_time) {
+            return elapsed / n;
+        }
+    }
+}
+
+// A machine with the program at 0x200. Repeated programs fill memory up to
+// 0xE00 and jump back, so straight-line code dominates. I points at the
+// font, so draws have set pixels to XOR.
+CHIP8 machine(CHIP8::Engine const engine, std::vector<uint16_t> const& program,
+              bool const repeat, std::vector<uint8_t> const& registers = {}) {
+    CHIP8 chip8 {};
+    chip8.engine = engine;
+
+    CHIP8::State state {};
+    chip8.save_state(state);
+
+    uint16_t address {0x200};
+
+    do {
+        for (uint16_t const op : program) {
+            state.memory[address] = op >> 8;
+            state.memory[address + 1] = op & 0xFF;
+            address += 2;
+        }
+    } while (repeat && address + 2 * program.size() <= 0xDFE);
+
+    if (repeat) {
+        state.memory[address] = 0x12;
+        state.memory[address + 1] = 0x00;
+    }
+
+    std::copy(registers.begin(), registers.end(), state.registers);
+    state.I = 0x050;
+    state.pc = 0x200;
+    chip8.load_state(state);
+    return chip8;
+}
+
+struct Family {
+    char const *name;
+    std::vector<uint16_t> program;
+    bool repeat;
+};
+
+std::vector<Family> families() {
+    // Every jump lands on the next instruction
+    std::vector<uint16_t> jumps;
+
+    for (uint16_t address {0x200}; address < 0xDFE; address += 2) {
+        jumps.push_back(0x1000 | (address + 2));
+    }
+
+    jumps.push_back(0x1200);
+
+    return {
+        {"load", {0x6012}, true},
+        {"add", {0x7001}, true},
+        {"alu", {0x8014, 0x8125, 0x8232, 0x8306}, true},
+        {"skip", {0x3EFF, 0x4E00, 0x9EE0}, true},
+        {"jump", jumps, false},
+        {"call", {0x2204, 0x1200, 0x00EE}, false},
+        {"index", {0xA300, 0xF01E}, true},
+        {"memory", {0xAF00, 0xF355, 0xAF00, 0xF365}, true},
+        {"bcd", {0xAF00, 0xF033}, true},
+        {"font", {0xF029}, true},
+        {"random", {0xC0FF}, true},
+        {"timer", {0xF015, 0xF007, 0xF018}, true},
+        {"key", {0xE09E}, true},
+        {"draw", {0xD015}, true},
+    };
+}
+
+void bench_dispatch(Settings const& settings) {
+    std::printf("  \"dispatch\": [\n");
+    bool first {true};
+
+    for (CHIP8::Engine const engine : settings.engines) {
+        for (Family const& family : families()) {
+            CHIP8 chip8 {machine(engine, family.program, family.repeat)};
+
+            double const seconds {measure(settings, [&](uint64_t const n) {
+                for (uint64_t i {0}; i < n; i++) {
+                    chip8.cycle();
+                }
+            })};
+
+            std::printf("%s    {\"engine\": \"%s\", \"family\": \"%s\", "
+                        "\"ns_per_instruction\": %.3f}",
+                        first ? "" : ",\n", engine_name(engine), family.name,
+                        seconds * 1e9);
+            first = false;
+        }
+    }
+
+    std::printf("\n  ],\n");
+}
+
+void bench_tables(Settings const& settings) {
+    std::printf("  \"tables\": [\n");
+    bool first {true};
+
+    for (CHIP8::Engine const engine : settings.engines) {
+        double const seconds {measure(settings, [&](uint64_t const n) {
+            for (uint64_t i {0}; i < n; i++) {
+                CHIP8 chip8 {machine(engine, {0x6012}, false)};
+                chip8.run(1);
+            }
+        })};
+
+        std::printf("%s    {\"engine\": \"%s\", \"bytes\": %zu, "
+                    "\"startup_ns\": %.3f}",
+                    first ? "" : ",\n", engine_name(engine),
+                    CHIP8::dispatch_bytes(engine), seconds * 1e9);
+        first = false;
+    }
+
+    std::printf("\n  ],\n");
+}
+
+void bench_draw(Settings const& settings) {
+    struct Case {
+        char const *name;
+        uint8_t x;
+        uint8_t y;
+    };
+
+    Case const cases[] {
+        {"unclipped", 8, 8},
+        {"clip_right", 60, 8},
+        {"clip_bottom", 8, 30},
+        {"clip_corner", 60, 30},
+        {"wrapped_origin", 64 + 8, 32 + 8},
+    };
+
+    std::printf("  \"draw\": [\n");
+    bool first {true};
+
+    for (uint8_t const height : {1, 5, 15}) {
+        for (Case const& c : cases) {
+            CHIP8 chip8 {machine(CHIP8::Engine::CACHED,
+                                 {static_cast<uint16_t>(0xD010 | height)},
+                                 true, {c.x, c.y})};
+
+            double const seconds {measure(settings, [&](uint64_t const n) {
+                chip8.run(n);
+            })};
+
+            std::printf("%s    {\"height\": %d, \"case\": \"%s\", "
+                        "\"ns_per_draw\": %.3f, \"draws_per_second\": %.0f}",
+                        first ? "" : ",\n", height, c.name, seconds * 1e9,
+                        1 / seconds);
+            first = false;
+        }
+    }
+
+    std::printf("\n  ],\n");
+}
+
+void bench_snapshot(Settings const& settings) {
+    CHIP8 chip8 {machine(CHIP8::Engine::CACHED, {0xD015, 0x7001}, true)};
+    chip8.run(10000);
+
+    CHIP8::State state {};
+    chip8.save_state(state);
+    std::vector<uint8_t> bytes(CHIP8::SERIALIZED_SIZE);
+    CHIP8::serialize(state, bytes.data());
+    Rewind history {};
+
+    struct Operation {
+        char const *name;
+        double seconds;
+    };
+
+    Operation const operations[] {
+        {"save_state", measure(settings, [&](uint64_t const n) {
+             for (uint64_t i {0}; i < n; i++) {
+                 chip8.save_state(state);
+             }
+         })},
+        {"load_state", measure(settings, [&](uint64_t const n) {
+             for (uint64_t i {0}; i < n; i++) {
+                 chip8.load_state(state);
+             }
+         })},
+        {"serialize", measure(settings, [&](uint64_t const n) {
+             for (uint64_t i {0}; i < n; i++) {
+                 CHIP8::serialize(state, bytes.data());
+             }
+         })},
+        {"deserialize", measure(settings, [&](uint64_t const n) {
+             for (uint64_t i {0}; i < n; i++) {
+                 CHIP8::deserialize(bytes.data(), bytes.size(), state);
+             }
+         })},
+        // One changed register per frame, like a game counting down
+        {"rewind_push", measure(settings, [&](uint64_t const n) {
+             for (uint64_t i {0}; i < n; i++) {
+                 state.registers[0]++;
+                 history.push(state);
+             }
+         })},
+    };
+
+    std::printf("  \"snapshot\": [\n");
+    bool first {true};
+
+    for (Operation const& op : operations) {
+        std::printf("%s    {\"operation\": \"%s\", \"ns\": %.3f}",
+                    first ? "" : ",\n", op.name, op.seconds * 1e9);
+        first = false;
+    }
+
+    std::printf("\n  ],\n");
+}
+
+struct Workload {
+    std::string name;
+    // Either a ROM file or a program built in
+    std::string path;
+    std::vector<uint16_t> program;
+};
+
+std::vector<Workload> workloads(std::vector<std::string> const& roms) {
+    std::vector<Workload> list {
+        // Counts with ALU work and a conditional loop
+        {"builtin:loop", "",
+         {0x6100, 0x7101, 0x8210, 0x8226, 0x8234, 0x3100, 0x1202, 0x1200}},
+        // Moves sprites around the screen, clipping at the edges
+        {"builtin:sprites", "",
+         {0xA050, 0xD015, 0x7003, 0x7102, 0xD01F, 0x1202}},
+        // Calls, returns and the delay timer
+        {"builtin:calls", "",
+         {0x2206, 0xF007, 0x1200, 0x6020, 0xF015, 0x00EE}},
+    };
+
+    std::vector<std::string> paths {roms};
+
+#ifdef CHIP8_ROM_DIR
+    if (paths.empty() && fs::is_directory(CHIP8_ROM_DIR)) {
+        for (auto const& entry : fs::directory_iterator{CHIP8_ROM_DIR}) {
+            if (entry.path().extension() == ".ch8") {
+                paths.push_back(entry.path().string());
+            }
+        }
+
+        std::sort(paths.begin(), paths.end());
+    }
+#endif
+
+    for (std::string const& path : paths) {
+        list.push_back({fs::path{path}.filename().string(), path, {}});
+    }
+
+    return list;
+}
+
+bool bench_workloads(Settings const& settings,
+                     std::vector<std::string> const& roms) {
+    std::printf("  \"workloads\": [\n");
+    bool first {true};
+    bool ok {true};
+
+    for (Workload const& workload : workloads(roms)) {
+        for (CHIP8::Engine const engine : settings.engines) {
+            CHIP8 chip8 {machine(engine, workload.program, false)};
+
+            if (!workload.path.empty() && !chip8.run_rom(workload.path)) {
+                ok = false;
+                break;
+            }
+
+            // Engines that fast-forward idle loops count cycles they never
+            // ran, so ips only covers the ones executed
+            uint64_t const skipped_before {chip8.skipped_count()};
+            uint64_t cycles {0};
+            uint64_t last_n {0};
+            uint64_t last_executed {0};
+            double const per_n {measure(settings, [&](uint64_t const n) {
+                uint64_t const skipped {chip8.skipped_count()};
+                uint64_t const run {chip8.run(n * 1024)};
+                last_n = n;
+                last_executed = run - (chip8.skipped_count() - skipped);
+                cycles += run;
+            })};
+            double const seconds {per_n * last_n};
+            uint64_t const skipped {chip8.skipped_count() - skipped_before};
+
+            std::printf("%s    {\"workload\": \"%s\", \"engine\": \"%s\", "
+                        "\"skips_idle\": %s, \"ips\": %.0f, "
+                        "\"cycles\": %llu, \"executed\": %llu, "
+                        "\"skipped\": %llu}",
+                        first ? "" : ",\n", workload.name.c_str(),
+                        engine_name(engine),
+                        CHIP8::skips_idle(engine) ? "true" : "false",
+                        last_executed / seconds,
+                        static_cast<unsigned long long>(cycles),
+                        static_cast<unsigned long long>(cycles - skipped),
+                        static_cast<unsigned long long>(skipped));
+            first = false;
+        }
+    }
+
+    std::printf("\n  ]\n");
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Settings settings {};
+    std::vector<std::string> roms;
+
+    for (int i {1}; i < argc; i++) {
+        std::string const arg {argv[i]};
+        CHIP8::Engine engine;
+
+        if (arg == "--time" && i + 1 < argc &&
+            parse_number(argv[i + 1], settings.min_time)) {
+            settings.min_time = std::max(0.001, settings.min_time);
+            i++;
+        } else if (arg == "--engine" && i + 1 < argc &&
+                   parse_engine(argv[i + 1], engine)) {
+            settings.engines = {engine};
+            i++;
+        } else if (arg.rfind("--", 0) == 0) {
+            usage(argv[0]);
+            return 1;
+        } else {
+            roms.push_back(arg);
+        }
+    }
+
+    std::printf("{\n");
+    std::printf("  \"version\": 1,\n");
+#ifdef __VERSION__
+    std::printf("  \"compiler\": \"%s\",\n", __VERSION__);
+#endif
+    std::printf("  \"min_time\": %.3f,\n", settings.min_time);
+
+    bench_dispatch(settings);
+    bench_tables(settings);
+    bench_draw(settings);
+    bench_snapshot(settings);
+    bool const ok {bench_workloads(settings, roms)};
+
+    std::printf("}\n");
+
+    if (!ok) {
+        std::cerr << "Some workloads could not be loaded" << std::endl;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -1,14 +1,81 @@
 #include "chip8.h"
-#include <GL/freeglut_std.h>
-#include <GL/gl.h>
+#include "aot.h"
+#include "jit.h"
+#include "semantics.h"
+#include "trace.h"
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <fstream>
 #include <iostream>
-#include <limits>
-#include <random>
+#include <iterator>
 #include <cstring>
 
+namespace {
+
+// Quirks read from the flags on every instruction
+struct RuntimeQuirks {
+    static CHIP8::Quirks constexpr PROFILE {CHIP8::Quirks::RUNTIME};
+
+    static bool jump(CHIP8 const& c) { return c.USE_LEGACY_JUMP; }
+    static bool shift(CHIP8 const& c) { return c.USE_LEGACY_SHIFT; }
+    static bool index_add(CHIP8 const& c) { return c.USE_LEGACY_INDEX_ADD; }
+    static bool load_store(CHIP8 const& c) { return c.USE_LEGACY_LOAD_STORE; }
+};
+
+// Quirks known at compile time, the branches on them fold away
+template <CHIP8::Quirks P, bool JUMP, bool SHIFT, bool INDEX_ADD,
+          bool LOAD_STORE>
+struct FixedQuirks {
+    static CHIP8::Quirks constexpr PROFILE {P};
+
+    static constexpr bool jump(CHIP8 const&) { return JUMP; }
+    static constexpr bool shift(CHIP8 const&) { return SHIFT; }
+    static constexpr bool index_add(CHIP8 const&) { return INDEX_ADD; }
+    static constexpr bool load_store(CHIP8 const&) { return LOAD_STORE; }
+};
+
+using CosmacVipQuirks =
+    FixedQuirks<CHIP8::Quirks::COSMAC_VIP, true, true, false, true>;
+// Really moves I by X instead of X + 1, the nearest the flags get
+using Chip48Quirks =
+    FixedQuirks<CHIP8::Quirks::CHIP48, false, false, false, true>;
+using SuperChipQuirks =
+    FixedQuirks<CHIP8::Quirks::SUPER_CHIP, false, false, false, false>;
+
+// Same order as CHIP8::Op
+char const *const OP_NAMES[] {
+    "UNDECODED", "NOP", "CLS", "RET", "JP", "JP_V0", "CALL", "SE_VX_NN",
+    "SNE_VX_NN", "SE_VX_VY", "SNE_VX_VY", "LD_VX_NN", "ADD_VX_NN", "LD_I",
+    "DRW", "RND", "LD_VX_VY", "OR", "AND", "XOR", "ADD_VX_VY", "SUB", "SHR",
+    "SUBN", "SHL", "SKP", "SKNP", "LD_VX_DT", "LD_DT_VX", "LD_ST_VX",
+    "ADD_I_VX", "LD_VX_K", "LD_F_VX", "LD_B_VX", "LD_I_VX", "LD_VX_I",
+    "LD_I_DRW", "LD_VX_NN_LD_VY_NN", "ADD_SE_JP", "LD_I_LD_VX_I",
+};
+
+// Cycle count after running cycles more, saturating
+uint64_t cycles_after(uint64_t const now, uint64_t const cycles) {
+    return cycles > UINT64_MAX - now ? UINT64_MAX : now + cycles;
+}
+
+} // namespace
+
+template <typename F>
+decltype(auto) CHIP8::with_quirks(F &&fn) {
+    switch (active_quirks) {
+        case Quirks::COSMAC_VIP:
+            return fn(CosmacVipQuirks{});
+
+        case Quirks::CHIP48:
+            return fn(Chip48Quirks{});
+
+        case Quirks::SUPER_CHIP:
+            return fn(SuperChipQuirks{});
+
+        default:
+            return fn(RuntimeQuirks{});
+    }
+}
 
 std::unordered_map<char, int> const CHIP8::KEYMAP {
     {'1', 0x1},
@@ -77,21 +144,32 @@ CHIP8::CHIP8() {
         0xF0, 0x80, 0xF0,
         0x80, 0x80 // F
     };
-    std::copy(std::begin(font), std::end(font), &(memory[0x50]));
+    std::copy(std::begin(font), std::end(font), &(state.memory[0x50]));
 }
 
-void CHIP8::run_rom(std::string const& path) {
+bool CHIP8::run_rom(std::string const& path) {
     std::ifstream ifs(path, std::ios::binary);
 
     if (!ifs.is_open()) {
         std::cerr << "Could not open file" << std::endl;
-        return;
+        return false;
     }
 
     // Start reading into RAM at adress 0x200
-    ifs.read(reinterpret_cast<char *>(&memory[0x200]), 4096);
+    ifs.read(reinterpret_cast<char *>(&state.memory[0x200]),
+             sizeof(state.memory) - 0x200);
+    // Anything decoded before the load is stale now
+    std::fill(std::begin(decode_cache), std::end(decode_cache), Instr{});
+
+    if (jit_slot.jit) {
+        jit_slot.jit->flush();
+    }
+
+    AOT::attach(*this);
+    select_quirks();
     // Start the program
-    pc = 0x200;
+    state.pc = 0x200;
+    return true;
 }
 
 void CHIP8::cycle(bool const force) {
@@ -99,329 +177,1313 @@ void CHIP8::cycle(bool const force) {
         return;
     }
 
+    if (engine == Engine::JIT && jit()) {
+        jit()->run(*this, 1);
+    } else if (engine == Engine::AOT && use_aot()) {
+        AOT::run(*this, 1);
+    } else if (engine == Engine::THREADED) {
+        with_quirks([this](auto q) { run_threaded<decltype(q)>(1); });
+    } else {
+        advance_timers();
+        step();
+    }
+
+    if (frame_ready) {
+        frame_ready = false;
+
+        if (on_frame) {
+            on_frame(*this);
+        }
+    }
+}
+
+uint64_t CHIP8::run(uint64_t const cycles) {
+    if (is_paused) {
+        return 0;
+    }
+
+    // Frame hooks have to see the machine between instructions. Idle loops
+    // are never skipped past a frame, so they still can be.
+    if (on_frame) {
+        for (uint64_t executed {0}; executed < cycles;) {
+            run_end = cycles_after(state.cycles, cycles - executed);
+            extra_cycles = 0;
+            cycle();
+            executed += 1 + extra_cycles;
+        }
+
+        run_end = 0;
+        return cycles;
+    }
+
+    if (engine == Engine::JIT && jit()) {
+        return jit()->run(*this, cycles);
+    }
+
+    run_end = cycles_after(state.cycles, cycles);
+
+    // Set up like the interpreters, which blocks fall back to
+    if (engine == Engine::AOT && use_aot()) {
+        uint64_t const executed {AOT::run(*this, cycles)};
+        run_end = 0;
+        return executed;
+    }
+
+    // Pick the profile once rather than every instruction
+    uint64_t const executed {with_quirks([this, cycles](auto q) {
+        using Q = decltype(q);
+
+        if (engine == Engine::THREADED) {
+            return run_threaded<Q>(cycles);
+        }
+
+        return run_stepped<Q>(cycles);
+    })};
+
+    run_end = 0;
+    return executed;
+}
+
+uint64_t CHIP8::run_frame(uint64_t const input_until) {
+    if (is_paused) {
+        return 0;
+    }
+
+    apply_input(input_until);
+
+    uint64_t const frame {state.frames};
+
+    // Cycles left before the timers tick, less one for rounding
+    uint64_t const estimate {
+        static_cast<uint64_t>((1.0 - state.accum_time) * ips / 60.0)};
+    uint64_t executed {estimate > 1 ? run(estimate - 1) : 0};
+
+    while (state.frames == frame) {
+        executed += run(1);
+    }
+
+    return executed;
+}
+
+void CHIP8::apply_input(uint64_t const until) {
+    keystates &= ~pending_release;
+    pending_release = 0;
+
+    uint16_t pressed {0};
+
+    for (KeyEvent const *event {key_events.front()};
+         event && event->time <= until; event = key_events.front()) {
+        uint16_t const bit = 0x1 << (event->key & 0xF);
+
+        if (event->pressed) {
+            keystates |= bit;
+            pressed |= bit;
+            pending_release &= ~bit;
+        } else if (pressed & bit) {
+            pending_release |= bit;
+        } else {
+            keystates &= ~bit;
+        }
+
+        key_events.pop();
+    }
+}
+
+void CHIP8::advance_timers() {
+    state.cycles++;
+
     // Tick down the timers at 60Hz
-    accum_time += 60.0 / REFRESH_RATE;
+    state.accum_time += 60.0 / ips;
     double tick;
-    modf(accum_time, &tick);
+    modf(state.accum_time, &tick);
     timer_tick(tick);
 
     if (tick >= 1) {
-        // Copy the contents of the buffer into the display
-        std::copy(
-            &display_buffer[0][0],
-            &display_buffer[0][0] + DISPLAY_WIDTH * DISPLAY_HEIGHT,
-            &display[0][0]
-        );
+        present();
+        state.frames++;
+        frame_ready = true;
+    }
+
+    state.accum_time -= tick;
+}
+
+void CHIP8::fast_forward() {
+#ifdef CHIP8_PROFILE
+    // Skipped cycles would be missing from the counters
+    return;
+#endif
+
+#ifdef CHIP8_TRACE
+    // And from the trace
+    if (tracer) {
+        return;
+    }
+#endif
+
+    uint16_t const pc {state.pc};
+
+    if (pc > 0x1000 - 6) {
+        return;
+    }
+
+    auto const opcode = [this](uint16_t const address) {
+        return static_cast<uint16_t>(state.memory[address] << 8 |
+                                     state.memory[address + 1]);
+    };
+    uint16_t const op {opcode(pc)};
+    uint8_t const X = (op & OpMask::X) >> 8;
+
+    if (op == (0x1000 | pc)) {
+        // Jumps to itself
+        skip_idle(1);
+    } else if ((op & 0xF0FF) == 0xF00A && !keystates) {
+        // Waits for a key, only apply_input() presses one
+        skip_idle(1);
+    } else if ((op & 0xF0FF) == 0xF007 &&
+               (opcode(pc + 2) & 0xFF00) == (0x3000 | X << 8) &&
+               opcode(pc + 4) == (0x1000 | pc) &&
+               (opcode(pc + 2) & 0x00FF) != state.delay_timer) {
+        // Reads the delay timer until it reaches a value, which it cannot
+        // before the next tick
+        if (skip_idle(3)) {
+            state.registers[X] = state.delay_timer;
+        }
+    }
+}
+
+uint64_t CHIP8::skip_idle(uint64_t const length) {
+    if (run_end <= state.cycles) {
+        return 0;
+    }
+
+    uint64_t const budget {run_end - state.cycles};
+    double const step {60.0 / ips};
+    double accum {state.accum_time};
+    double kept {accum};
+    uint64_t skipped {0};
+
+    // Whole iterations of the loop, stopping short of the cycle that ticks
+    // the timers. Same sums as advance_timers(), so that one stays the same.
+    for (uint64_t n {1}; n <= budget; n++) {
+        accum += step;
+
+        if (accum >= 1.0) {
+            break;
+        }
+
+        if (n % length == 0) {
+            kept = accum;
+            skipped = n;
+        }
+    }
+
+    state.accum_time = kept;
+    state.cycles += skipped;
+    extra_cycles += skipped;
+    skipped_cycles += skipped;
+    return skipped;
+}
+
+void CHIP8::present() {
+    // Only rows drawn to since the last frame can differ. Sprites erased
+    // and redrawn in between leave the row as it was.
+    bool changed {false};
+
+    for (int y {0}; y < DISPLAY_HEIGHT; y++) {
+        if ((dirty_rows >> y & 0x1) &&
+            presented.rows[y] != state.display_buffer[y]) {
+            presented.rows[y] = state.display_buffer[y];
+            changed = true;
+        }
+    }
+
+    dirty_rows = 0;
+
+    if (changed) {
+        publish();
     }
+}
+
+void CHIP8::publish() {
+    presented.generation++;
+    output.back() = presented;
+    output.publish();
+}
 
-    accum_time -= tick;
+void CHIP8::select_quirks() {
+    active_quirks = quirks;
 
+    // Whatever else reads the flags has to agree with the profile
+    QuirkFlags const flags {quirk_flags()};
+    USE_LEGACY_JUMP = flags.jump;
+    USE_LEGACY_SHIFT = flags.shift;
+    USE_LEGACY_INDEX_ADD = flags.index_add;
+    USE_LEGACY_LOAD_STORE = flags.load_store;
+}
+
+CHIP8::QuirkFlags CHIP8::quirk_flags() {
+    return with_quirks([this](auto q) {
+        using Q = decltype(q);
+        return QuirkFlags {Q::jump(*this), Q::shift(*this),
+                           Q::index_add(*this), Q::load_store(*this)};
+    });
+}
+
+void CHIP8::step() {
+    with_quirks([this](auto q) { step_with<decltype(q)>(); });
+}
+
+template <typename Q>
+void CHIP8::step_with() {
+    switch (engine) {
+        case Engine::SWITCH:
+            step_switch<Q>();
+            break;
+
+        case Engine::CACHED:
+        case Engine::JIT:
+        case Engine::THREADED:
+        case Engine::AOT:
+            step_cached<Q>();
+            break;
+
+        case Engine::TABLE:
+            step_table<Q>();
+            break;
+    }
+}
+
+template <typename Q>
+uint64_t CHIP8::run_stepped(uint64_t const cycles) {
+    // Counted on the machine, skipped and fused cycles count too
+    uint64_t const start {state.cycles};
+    uint64_t const end {cycles_after(start, cycles)};
+
+    while (state.cycles < end) {
+        advance_timers();
+        step_with<Q>();
+    }
+
+    return state.cycles - start;
+}
+
+JIT *CHIP8::jit() {
+#ifdef CHIP8_PROFILE
+    // Compiled blocks would bypass the counters
+    return nullptr;
+#endif
+
+#ifdef CHIP8_TRACE
+    // And the tracer
+    if (tracer) {
+        return nullptr;
+    }
+#endif
+
+    if (!jit_slot.jit) {
+        jit_slot.jit = std::make_unique<JIT>();
+    }
+
+    return jit_slot.jit->available() ? jit_slot.jit.get() : nullptr;
+}
+
+bool CHIP8::use_aot() const {
+#ifdef CHIP8_PROFILE
+    // Translated blocks bypass the counters like compiled ones
+    return false;
+#endif
+
+#ifdef CHIP8_TRACE
+    if (tracer) {
+        return false;
+    }
+#endif
+
+    return !aot_blocks.empty();
+}
+
+template <typename Q>
+void CHIP8::step_switch() {
     uint16_t const op{fetch()};
 
-    uint16_t const X{static_cast<uint16_t>((op & OpMask::X) >> 8)};
-    uint16_t const Y{static_cast<uint16_t>((op & OpMask::Y) >> 4)};
-    uint16_t const N{static_cast<uint16_t>(op & OpMask::N)};
-    uint16_t const NN{static_cast<uint16_t>(op & OpMask::NN)};
-    uint16_t const NNN{static_cast<uint16_t>(op & OpMask::NNN)};
+    Instr const in {
+        Op::UNDECODED,
+        static_cast<uint8_t>((op & OpMask::X) >> 8),
+        static_cast<uint8_t>((op & OpMask::Y) >> 4),
+        static_cast<uint8_t>(op & OpMask::N),
+        static_cast<uint8_t>(op & OpMask::NN),
+        static_cast<uint16_t>(op & OpMask::NNN),
+    };
 
     switch (op & 0xF000) {
         case 0x0000:
             switch (op) {
-                // Clear the screen
                 case 0x00E0:
-                    std::fill(
-                        &display_buffer[0][0],
-                        &display_buffer[0][0] + DISPLAY_WIDTH * DISPLAY_HEIGHT,
-                        false 
-                    );
+                    exec<Op::CLS, Q>(in);
                     break;
 
-                // Return from subroutine
                 case 0x00EE:
-                    pc = stack.top();
-                    stack.pop();
+                    exec<Op::RET, Q>(in);
+                    break;
+
+                // Unknown opcodes do nothing, like NOP in the decode cache
+                default:
+                    exec<Op::NOP, Q>(in);
                     break;
             }
             break;
 
-        // Jump
         case 0x1000:
-            pc = NNN;
+            exec<Op::JP, Q>(in);
             break;
 
         case 0xB000:
-            if (USE_LEGACY_JUMP) {
-                pc = registers[0x0] + NNN;
-            } else {
-                pc = registers[X] + NNN;
-            }
+            exec<Op::JP_V0, Q>(in);
             break;
 
-        // Call Subroutine
         case 0x2000:
-            stack.push(pc);
-            pc = NNN;
+            exec<Op::CALL, Q>(in);
             break;
 
-        // Skip if Equal
         case 0x3000:
-            pc += 2 * (registers[X] == NN);
+            exec<Op::SE_VX_NN, Q>(in);
             break;
 
-        // Skip if not Equal
         case 0x4000:
-            pc += 2 * (registers[X] != NN);
+            exec<Op::SNE_VX_NN, Q>(in);
             break;
 
-        // Skip if registers are Equal
         case 0x5000:
-            pc += 2 * (registers[X] == registers[Y]);
+            exec<Op::SE_VX_VY, Q>(in);
             break;
 
-        // Skip if registers are not Equal
         case 0x9000:
-            pc += 2 * (registers[X] != registers[Y]);
+            exec<Op::SNE_VX_VY, Q>(in);
             break;
 
-        //  Set
         case 0x6000:
-            registers[X] = NN;
+            exec<Op::LD_VX_NN, Q>(in);
             break;
 
-        // Add
         case 0x7000:
-            registers[X] += NN;
+            exec<Op::ADD_VX_NN, Q>(in);
             break;
 
-        // Set Index Register
         case 0xA000:
-            I = NNN;
+            exec<Op::LD_I, Q>(in);
             break;
 
-        // Draw
         case 0xD000:
-            draw(X, Y, N);
+            exec<Op::DRW, Q>(in);
             break;
 
-        // Random
-        case 0xC000: {
-            std::random_device rng{};
-            std::mt19937 gen{rng()};
-            std::uniform_int_distribution<uint16_t> dis{0, std::numeric_limits<uint16_t>::max()};
-
-            uint16_t const rand{dis(gen)};
-            registers[X] = rand & NN;
-
+        case 0xC000:
+            exec<Op::RND, Q>(in);
             break;
-        }
-
-        case 0x8000: {
-            uint16_t const instr{static_cast<uint16_t>(op & 0x000F)};
 
-            switch(instr) {
-                // Set
+        case 0x8000:
+            switch(in.N) {
                 case 0x0000:
-                    registers[X] = registers[Y];
+                    exec<Op::LD_VX_VY, Q>(in);
                     break;
 
-                // Binary OR
                 case 0x0001:
-                    registers[X] = registers[X] | registers[Y];
-                    registers[0xF] = 0;
+                    exec<Op::OR, Q>(in);
                     break;
 
-                // Binary AND
                 case 0x0002:
-                    registers[X] = registers[X] & registers[Y];
-                    registers[0xF] = 0;
+                    exec<Op::AND, Q>(in);
                     break;
 
-                // Logical XOR
                 case 0x0003:
-                    registers[X] = registers[X] ^ registers[Y];
-                    registers[0xF] = 0;
+                    exec<Op::XOR, Q>(in);
                     break;
 
-                // Add
                 case 0x0004:
-                    registers[X] = registers[X] + registers[Y];
-                    // If the sum is smaller than the operand, overflow occured
-                    registers[0xF] = registers[X] < registers[Y];
+                    exec<Op::ADD_VX_VY, Q>(in);
                     break;
 
-                // Subtract X-Y
-                case 0x0005: {
-                    bool const carry {registers[Y] > registers[X]};
-                    registers[X] = registers[X] - registers[Y];
-                    registers[0xF] = !carry;
+                case 0x0005:
+                    exec<Op::SUB, Q>(in);
                     break;
-                }
 
-                // Subtract Y-X
-                case 0x0007: {
-                    bool const carry {registers[X] > registers[Y]};
-                    registers[X] = registers[Y] - registers[X];
-                    registers[0xF] = !carry;
+                case 0x0007:
+                    exec<Op::SUBN, Q>(in);
                     break;
-                }
 
-                // Shift Right
-                case 0x0006: {
-                    if (USE_LEGACY_SHIFT) {
-                        registers[X] = registers[Y];
-                    }
-                    // fuck brace initialization, I know this cast is fine
-                    // I don't need to tell you that im not stupid, compiler
-                    uint8_t const carry = registers[X] & 0x01;
-                    registers[X] >>= 0x1;
-                    registers[0xF] = carry;
+                case 0x0006:
+                    exec<Op::SHR, Q>(in);
                     break;
-                }
 
-                // Shift Left
                 case 0x000E:
-                    if (USE_LEGACY_SHIFT) {
-                        registers[X] = registers[Y];
-                    }
-                    // looking at you g++
-                    uint8_t const carry = (registers[X] & 0x80) >> 7;
-                    registers[X] <<= 0x1; 
-                    registers[0xF] = carry;
+                    exec<Op::SHL, Q>(in);
+                    break;
+
+                default:
+                    exec<Op::NOP, Q>(in);
                     break;
             }
             break;
-        }
 
-        // Key presses
         case 0XE000:
-            switch(NN) {
-                // Skip if key in X is pressed
+            switch(in.NN) {
                 case 0x009E:
-                    pc += 2 * ((keystates & (0x1 << registers[X])) != 0);
+                    exec<Op::SKP, Q>(in);
                     break;
 
-                // Skip if key in X is not pressed
                 case 0x00A1:
-                    pc += 2 * ((keystates & (0x1 << registers[X])) == 0);
+                    exec<Op::SKNP, Q>(in);
+                    break;
+
+                default:
+                    exec<Op::NOP, Q>(in);
                     break;
             }
             break;
 
-        // Timers
         case 0xF000:
-            switch(NN) {
-                // Set X to Delay Timer
+            switch(in.NN) {
                 case 0x0007:
-                    registers[X] = delay_timer;
+                    exec<Op::LD_VX_DT, Q>(in);
                     break;
 
-                // Set the Delay Timer to X
                 case 0x0015:
-                    delay_timer = registers[X];
+                    exec<Op::LD_DT_VX, Q>(in);
                     break;
 
-                // Set the Sound Timer to X
                 case 0x0018:
-                    sound_timer = registers[X];
+                    exec<Op::LD_ST_VX, Q>(in);
                     break;
 
-                // Add X to Index
                 case 0x001E:
-                    I += registers[X];
-
-                    if (USE_LEGACY_INDEX_ADD)
-                        // Set overflow flag
-                        registers[0xF] = I < registers[X];
+                    exec<Op::ADD_I_VX, Q>(in);
                     break;
 
-                // Get key (block until a key is pressed)
                 case 0x000A:
-                    if (keystates) {
-                        // Set X to the first key pressed that is found
-                        for (int i {}; i < 16; i++) {
-                            if (keystates & (0x1 << i)) {
-                                registers[X] = i;
-                                break;
-                            }
-                        }
-
-                    } else {
-                        pc -= 2;
-                    }
+                    exec<Op::LD_VX_K, Q>(in);
                     break;
 
-                // Font character
                 case 0x0029:
-                    I = 0x0050 + 5 * registers[X]; 
+                    exec<Op::LD_F_VX, Q>(in);
                     break;
-                    
-                // Binary coded decimal conversion
-                case 0x0033: {
-                    uint8_t const num {registers[X]};
-                    memory[I] = num / 100;
-                    memory[I+1] = (num % 100) / 10;
-                    memory[I+2] = num % 10;
+
+                case 0x0033:
+                    exec<Op::LD_B_VX, Q>(in);
                     break;
-                }
 
-                // Store memory
                 case 0x0055:
-                    std::memcpy(memory + I, registers, X + 1);
-                    I += (X + 1) * USE_LEGACY_LOAD_STORE;
+                    exec<Op::LD_I_VX, Q>(in);
                     break;
 
-                // Load memory
                 case 0x0065:
-                    std::memcpy(registers, memory + I, X + 1);
-                    I += (X + 1) * USE_LEGACY_LOAD_STORE;
+                    exec<Op::LD_VX_I, Q>(in);
+                    break;
+
+                default:
+                    exec<Op::NOP, Q>(in);
                     break;
             }
     }
 }
 
-uint16_t CHIP8::fetch() {
-    pc += 2;
-    return (static_cast<uint16_t>(memory[pc - 2] << 8) |
-    static_cast<uint16_t>(memory[pc - 1]));
+template <typename Q>
+void CHIP8::step_cached() {
+    // Copy the entry, executing it may invalidate its slot
+    Instr in {decode_cache[state.pc & 0x0FFF]};
+
+    if (in.op == Op::UNDECODED) {
+        in = decode_at(state.pc & 0x0FFF);
+    }
+
+    state.pc += 2;
+    (this->*HANDLERS[static_cast<size_t>(Q::PROFILE)]
+                    [static_cast<size_t>(in.op)])(in);
 }
 
-void CHIP8::pause() {
-    is_paused = true;
+template <typename Q>
+void CHIP8::step_table() {
+    uint16_t const op = state.memory[state.pc & 0x0FFF] << 8 |
+                        state.memory[(state.pc + 1) & 0x0FFF];
+    state.pc += 2;
+    OPCODE_TABLES[static_cast<size_t>(Q::PROFILE)][op](*this, operands(op));
 }
 
-void CHIP8::resume() {
-    is_paused = false;
+template <typename Q>
+uint64_t CHIP8::run_threaded(uint64_t const cycles) {
+#if defined(__GNUC__)
+// Label addresses are a GNU extension
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+#define LABEL(NAME) &&OP_##NAME
+
+#define DISPATCH() \
+    do { \
+        if (state.cycles >= end) { \
+            goto done; \
+        } \
+        advance_timers(); \
+        in = decode_cache[state.pc & 0x0FFF]; \
+        state.pc += 2; \
+        goto *LABELS[static_cast<size_t>(in.op)]; \
+    } while (0)
+
+#define HANDLER(NAME) \
+    OP_##NAME: \
+        exec<Op::NAME, Q>(in); \
+        DISPATCH();
+
+#define FUSED(NAME) \
+    OP_##NAME: \
+        exec_fused<Op::NAME, Q>(in); \
+        DISPATCH();
+
+    // Same order as Op
+    static void *const LABELS[] {
+        LABEL(UNDECODED), LABEL(NOP), LABEL(CLS), LABEL(RET), LABEL(JP),
+        LABEL(JP_V0), LABEL(CALL), LABEL(SE_VX_NN), LABEL(SNE_VX_NN),
+        LABEL(SE_VX_VY), LABEL(SNE_VX_VY), LABEL(LD_VX_NN), LABEL(ADD_VX_NN),
+        LABEL(LD_I), LABEL(DRW), LABEL(RND), LABEL(LD_VX_VY), LABEL(OR),
+        LABEL(AND), LABEL(XOR), LABEL(ADD_VX_VY), LABEL(SUB), LABEL(SHR),
+        LABEL(SUBN), LABEL(SHL), LABEL(SKP), LABEL(SKNP), LABEL(LD_VX_DT),
+        LABEL(LD_DT_VX), LABEL(LD_ST_VX), LABEL(ADD_I_VX), LABEL(LD_VX_K),
+        LABEL(LD_F_VX), LABEL(LD_B_VX), LABEL(LD_I_VX), LABEL(LD_VX_I),
+        LABEL(LD_I_DRW), LABEL(LD_VX_NN_LD_VY_NN), LABEL(ADD_SE_JP),
+        LABEL(LD_I_LD_VX_I),
+    };
+    static_assert(std::size(LABELS) == static_cast<size_t>(Op::COUNT));
+
+    // Counted on the machine, skipped and fused cycles count too
+    uint64_t const start {state.cycles};
+    uint64_t const end {cycles_after(start, cycles)};
+    Instr in {};
+
+    DISPATCH();
+
+    // pc already points past the instruction
+    OP_UNDECODED: {
+        in = decode_at((state.pc - 2) & 0x0FFF);
+        goto *LABELS[static_cast<size_t>(in.op)];
+    }
+
+    HANDLER(NOP)
+    HANDLER(CLS)
+    HANDLER(RET)
+    HANDLER(JP)
+    HANDLER(JP_V0)
+    HANDLER(CALL)
+    HANDLER(SE_VX_NN)
+    HANDLER(SNE_VX_NN)
+    HANDLER(SE_VX_VY)
+    HANDLER(SNE_VX_VY)
+    HANDLER(LD_VX_NN)
+    HANDLER(ADD_VX_NN)
+    HANDLER(LD_I)
+    HANDLER(DRW)
+    HANDLER(RND)
+    HANDLER(LD_VX_VY)
+    HANDLER(OR)
+    HANDLER(AND)
+    HANDLER(XOR)
+    HANDLER(ADD_VX_VY)
+    HANDLER(SUB)
+    HANDLER(SHR)
+    HANDLER(SUBN)
+    HANDLER(SHL)
+    HANDLER(SKP)
+    HANDLER(SKNP)
+    HANDLER(LD_VX_DT)
+    HANDLER(LD_DT_VX)
+    HANDLER(LD_ST_VX)
+    HANDLER(ADD_I_VX)
+    HANDLER(LD_VX_K)
+    HANDLER(LD_F_VX)
+    HANDLER(LD_B_VX)
+    HANDLER(LD_I_VX)
+    HANDLER(LD_VX_I)
+    FUSED(LD_I_DRW)
+    FUSED(LD_VX_NN_LD_VY_NN)
+    FUSED(ADD_SE_JP)
+    FUSED(LD_I_LD_VX_I)
+
+done:
+    return state.cycles - start;
+
+#undef FUSED
+#undef HANDLER
+#undef DISPATCH
+#undef LABEL
+#pragma GCC diagnostic pop
+#else
+    return run_stepped<Q>(cycles);
+#endif
+}
+
+CHIP8::Instr CHIP8::decode(uint16_t const op) {
+    Instr in {operands(op)};
+    in.op = decode_op(op);
+    return in;
 }
 
-void CHIP8::draw(uint16_t const X, uint16_t const Y, uint16_t const N) {
-    uint8_t const x_reg{static_cast<uint8_t>(registers[X] % DISPLAY_WIDTH)};
-    uint8_t const y_reg{static_cast<uint8_t>(registers[Y] % DISPLAY_HEIGHT)};
-    registers[0xF] = false;
+char const *CHIP8::op_name(Op const op) {
+    static_assert(std::size(OP_NAMES) == static_cast<size_t>(Op::COUNT));
+    return OP_NAMES[static_cast<size_t>(op)];
+}
+
+CHIP8::Instr CHIP8::operands(uint16_t const op) {
+    return {
+        Op::NOP,
+        static_cast<uint8_t>((op & OpMask::X) >> 8),
+        static_cast<uint8_t>((op & OpMask::Y) >> 4),
+        static_cast<uint8_t>(op & OpMask::N),
+        static_cast<uint8_t>(op & OpMask::NN),
+        static_cast<uint16_t>(op & OpMask::NNN),
+    };
+}
+
+constexpr CHIP8::Op CHIP8::decode_op(uint16_t const op) {
+    // Mirrors the dispatch in step_switch, unknown opcodes do nothing
+    switch (op & 0xF000) {
+        case 0x0000:
+            if (op == 0x00E0) return Op::CLS;
+            if (op == 0x00EE) return Op::RET;
+            break;
+        case 0x1000: return Op::JP;
+        case 0x2000: return Op::CALL;
+        case 0x3000: return Op::SE_VX_NN;
+        case 0x4000: return Op::SNE_VX_NN;
+        case 0x5000: return Op::SE_VX_VY;
+        case 0x6000: return Op::LD_VX_NN;
+        case 0x7000: return Op::ADD_VX_NN;
+        case 0x9000: return Op::SNE_VX_VY;
+        case 0xA000: return Op::LD_I;
+        case 0xB000: return Op::JP_V0;
+        case 0xC000: return Op::RND;
+        case 0xD000: return Op::DRW;
 
-    for (int i{0}; i < N; i++) {
-        uint8_t pixels{memory[I+i]};
+        case 0x8000:
+            switch (op & OpMask::N) {
+                case 0x0: return Op::LD_VX_VY;
+                case 0x1: return Op::OR;
+                case 0x2: return Op::AND;
+                case 0x3: return Op::XOR;
+                case 0x4: return Op::ADD_VX_VY;
+                case 0x5: return Op::SUB;
+                case 0x6: return Op::SHR;
+                case 0x7: return Op::SUBN;
+                case 0xE: return Op::SHL;
+            }
+            break;
 
-        for (int j{0}; j < 8; j++) {
-            int const pixel_x {x_reg + j};
-            int const pixel_y {y_reg + i};
+        case 0xE000:
+            if ((op & OpMask::NN) == 0x9E) return Op::SKP;
+            if ((op & OpMask::NN) == 0xA1) return Op::SKNP;
+            break;
 
-            // Skip if drawing outside the display
-            if (pixel_x >= DISPLAY_WIDTH || pixel_y >= DISPLAY_HEIGHT) {
-                continue;
+        case 0xF000:
+            switch (op & OpMask::NN) {
+                case 0x07: return Op::LD_VX_DT;
+                case 0x0A: return Op::LD_VX_K;
+                case 0x15: return Op::LD_DT_VX;
+                case 0x18: return Op::LD_ST_VX;
+                case 0x1E: return Op::ADD_I_VX;
+                case 0x29: return Op::LD_F_VX;
+                case 0x33: return Op::LD_B_VX;
+                case 0x55: return Op::LD_I_VX;
+                case 0x65: return Op::LD_VX_I;
             }
+            break;
+    }
+
+    return Op::NOP;
+}
+
+CHIP8::Instr const& CHIP8::decoded(uint16_t const address) {
+    Instr &entry {decode_cache[address]};
 
-            bool &pixel = display_buffer[pixel_y][pixel_x];
-            // Extract the corresponding pixel
-            bool new_pixel = (pixels >> (7-j)) & 0x01;
+    if (entry.op == Op::UNDECODED) {
+        entry = decode(static_cast<uint16_t>(
+            state.memory[address] << 8 | state.memory[(address + 1) & 0x0FFF]));
+    }
 
-            registers[0xF] |= pixel && new_pixel;
-            pixel ^= new_pixel;
+    return entry;
+}
+
+CHIP8::Instr CHIP8::decode_at(uint16_t const address) {
+    Instr in {decode(static_cast<uint16_t>(
+        state.memory[address] << 8 | state.memory[(address + 1) & 0x0FFF]))};
+
+    // The entries after may be fused already, compare how they start
+    auto const plain = [this](uint16_t const at) {
+        Op const op {decoded(at).op};
+
+        switch (op) {
+            case Op::LD_I_DRW:
+            case Op::LD_I_LD_VX_I:
+                return Op::LD_I;
+            case Op::LD_VX_NN_LD_VY_NN:
+                return Op::LD_VX_NN;
+            case Op::ADD_SE_JP:
+                return Op::ADD_VX_NN;
+            default:
+                return op;
+        }
+    };
+
+    // Sequences never wrap around memory
+    if (address + 2 + FUSED_REACH <= sizeof(state.memory)) {
+        switch (in.op) {
+            case Op::LD_I:
+                if (plain(address + 2) == Op::DRW) {
+                    in.op = Op::LD_I_DRW;
+                } else if (plain(address + 2) == Op::LD_VX_I) {
+                    in.op = Op::LD_I_LD_VX_I;
+                }
+                break;
+
+            case Op::LD_VX_NN:
+                if (plain(address + 2) == Op::LD_VX_NN) {
+                    in.op = Op::LD_VX_NN_LD_VY_NN;
+                }
+                break;
+
+            case Op::ADD_VX_NN:
+                if (plain(address + 2) == Op::SE_VX_NN &&
+                    plain(address + 4) == Op::JP &&
+                    decoded(address + 4).NNN == address) {
+                    in.op = Op::ADD_SE_JP;
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    decode_cache[address] = in;
+    return in;
+}
+
+// Single machine view for execute(), straight onto the state
+template <typename Q>
+struct CHIP8::Self {
+    CHIP8 &c;
+
+    uint8_t &V(size_t const i) { return c.state.registers[i]; }
+    uint16_t &pc() { return c.state.pc; }
+    uint16_t &I() { return c.state.I; }
+    uint8_t &sp() { return c.state.sp; }
+    uint16_t &stack(size_t const i) { return c.state.stack[i]; }
+    uint8_t &delay_timer() { return c.state.delay_timer; }
+    uint8_t &sound_timer() { return c.state.sound_timer; }
+    uint64_t &row(size_t const y) { return c.state.display_buffer[y]; }
+    void touch_rows(uint32_t const rows) { c.dirty_rows |= rows; }
+    uint8_t memory(size_t const address) { return c.state.memory[address]; }
+    void write_memory(uint16_t const address, uint8_t const *src,
+                      size_t const size) {
+        c.write_memory(address, src, size);
+    }
+    uint16_t keystates() { return c.keystates; }
+    uint64_t &rng() { return c.state.rng; }
+    uint8_t &vip_random() { return c.state.vip_random; }
+    uint64_t cycles() { return c.state.cycles; }
+    Random random() { return c.random; }
+    bool legacy_jump() { return Q::jump(c); }
+    bool legacy_shift() { return Q::shift(c); }
+    bool legacy_index_add() { return Q::index_add(c); }
+    bool legacy_load_store() { return Q::load_store(c); }
+};
+
+template <CHIP8::Op OP, typename Q>
+void CHIP8::exec(Instr const& in) {
+#if defined(CHIP8_PROFILE) || defined(CHIP8_TRACE)
+    uint16_t const address = (state.pc - 2) & 0x0FFF;
+#endif
+
+#ifdef CHIP8_TRACE
+    Tracer::Record record {};
+    uint8_t registers[16];
+
+    if (tracer) {
+        record.cycle = state.cycles;
+        record.pc = address;
+        record.opcode = static_cast<uint16_t>(
+            state.memory[address] << 8 | state.memory[(address + 1) & 0x0FFF]);
+        std::memcpy(registers, state.registers, sizeof(registers));
+    }
+#endif
+
+#ifdef CHIP8_PROFILE
+    profile.ops[static_cast<size_t>(OP)]++;
+    profile.pcs[address]++;
+
+    if constexpr (OP == Op::LD_VX_K) {
+        profile.key_wait_cycles += keystates == 0;
+    } else if constexpr (OP == Op::JP) {
+        profile.self_jumps += in.NNN == address;
+    }
+
+    auto const start {OP == Op::DRW ? std::chrono::steady_clock::now()
+                                    : std::chrono::steady_clock::time_point{}};
+#endif
+
+    execute<OP>(Self<Q>{*this}, in);
+
+#ifdef CHIP8_PROFILE
+    if constexpr (OP == Op::DRW) {
+        profile.draws++;
+        profile.draw_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+#endif
+
+#ifdef CHIP8_TRACE
+    if (tracer) {
+        record.I = state.I;
+        record.reg = Tracer::NO_REGISTER;
+
+        // The highest register changed, VF only if nothing else was since
+        // it is mostly a side effect
+        for (uint8_t i {0}; i < 16; i++) {
+            uint8_t const reg = (i + 15) & 0xF;
+
+            if (registers[reg] != state.registers[reg]) {
+                record.reg = reg;
+                record.value = state.registers[reg];
+            }
+        }
+
+        tracer->record(record);
+    }
+#endif
+
+    // Idle loops go back through a jump or a key wait
+    if constexpr (OP == Op::JP || OP == Op::LD_VX_K) {
+        if (run_end) {
+            fast_forward();
+        }
+    }
+}
+
+template <CHIP8::Op OP, typename Q>
+void CHIP8::exec_fused(Instr const& in) {
+    // Copy the entries, executing them may invalidate their slots
+    auto const next = [this] {
+        Instr const follower {decode_cache[state.pc & 0x0FFF]};
+        state.pc += 2;
+        return follower;
+    };
+
+    if constexpr (OP == Op::LD_I_DRW) {
+        exec<Op::LD_I, Q>(in);
+
+        if (fuse_next()) {
+            exec<Op::DRW, Q>(next());
+        }
+    } else if constexpr (OP == Op::LD_I_LD_VX_I) {
+        exec<Op::LD_I, Q>(in);
+
+        if (fuse_next()) {
+            exec<Op::LD_VX_I, Q>(next());
+        }
+    } else if constexpr (OP == Op::LD_VX_NN_LD_VY_NN) {
+        exec<Op::LD_VX_NN, Q>(in);
+
+        if (fuse_next()) {
+            exec<Op::LD_VX_NN, Q>(next());
+        }
+    } else if constexpr (OP == Op::ADD_SE_JP) {
+        uint16_t const start = state.pc - 2;
+        exec<Op::ADD_VX_NN, Q>(in);
+
+        // Around the loop until it exits, ticks or the run ends. Nothing
+        // in it writes memory, so the entries stay valid.
+        while (fuse_next()) {
+            exec<Op::SE_VX_NN, Q>(next());
+
+            if (state.pc != start + 4 || !fuse_next()) {
+                return;
+            }
+
+            exec<Op::JP, Q>(next());
+
+            if (!fuse_next()) {
+                return;
+            }
+
+            state.pc += 2;
+            exec<Op::ADD_VX_NN, Q>(in);
         }
     }
 }
 
+bool CHIP8::fuse_next() {
+    double const accum {state.accum_time + 60.0 / ips};
+
+    if (state.cycles >= run_end || accum >= 1.0) {
+        return false;
+    }
+
+    // All advance_timers() does on a cycle without a tick
+    state.cycles++;
+    state.accum_time = accum;
+    extra_cycles++;
+    return true;
+}
+
+template <CHIP8::Op OP, typename Q>
+constexpr CHIP8::Handler CHIP8::handler() {
+    if constexpr (OP >= FIRST_FUSED) {
+        return &CHIP8::exec_fused<OP, Q>;
+    } else {
+        return &CHIP8::exec<OP, Q>;
+    }
+}
+
+template <typename Q, size_t... OPS>
+constexpr CHIP8::HandlerTable
+CHIP8::make_handlers(std::index_sequence<OPS...>) {
+    return {handler<static_cast<Op>(OPS), Q>()...};
+}
+
+// Same order as Quirks
+std::array<CHIP8::HandlerTable, static_cast<size_t>(CHIP8::Quirks::COUNT)> const
+CHIP8::HANDLERS {
+    make_handlers<RuntimeQuirks>(
+        std::make_index_sequence<static_cast<size_t>(Op::COUNT)>{}),
+    make_handlers<CosmacVipQuirks>(
+        std::make_index_sequence<static_cast<size_t>(Op::COUNT)>{}),
+    make_handlers<Chip48Quirks>(
+        std::make_index_sequence<static_cast<size_t>(Op::COUNT)>{}),
+    make_handlers<SuperChipQuirks>(
+        std::make_index_sequence<static_cast<size_t>(Op::COUNT)>{}),
+};
+
+template <CHIP8::Op OP, typename Q>
+void CHIP8::call(CHIP8 &c, Instr const& in) {
+    c.exec<OP, Q>(in);
+}
+
+template <typename Q, size_t... OPS>
+constexpr CHIP8::OpcodeTable
+CHIP8::make_opcode_table(std::index_sequence<OPS...>) {
+    OpcodeHandler const calls[] {&CHIP8::call<static_cast<Op>(OPS), Q>...};
+    OpcodeTable table {};
+
+    for (size_t op {0}; op < table.size(); op++) {
+        table[op] = calls[static_cast<size_t>(
+            decode_op(static_cast<uint16_t>(op)))];
+    }
+
+    return table;
+}
+
+// Same order as Quirks. Built by the compiler, nothing runs at startup.
+std::array<CHIP8::OpcodeTable, static_cast<size_t>(CHIP8::Quirks::COUNT)> const
+CHIP8::OPCODE_TABLES {
+    make_opcode_table<RuntimeQuirks>(
+        std::make_index_sequence<static_cast<size_t>(FIRST_FUSED)>{}),
+    make_opcode_table<CosmacVipQuirks>(
+        std::make_index_sequence<static_cast<size_t>(FIRST_FUSED)>{}),
+    make_opcode_table<Chip48Quirks>(
+        std::make_index_sequence<static_cast<size_t>(FIRST_FUSED)>{}),
+    make_opcode_table<SuperChipQuirks>(
+        std::make_index_sequence<static_cast<size_t>(FIRST_FUSED)>{}),
+};
+
+size_t CHIP8::dispatch_bytes(Engine const engine) {
+    switch (engine) {
+        case Engine::SWITCH:
+            return 0;
+
+        case Engine::CACHED:
+        case Engine::JIT:
+        case Engine::THREADED:
+            return sizeof(decode_cache) + sizeof(HANDLERS);
+
+        case Engine::TABLE:
+            return sizeof(OPCODE_TABLES);
+
+        // Falls back to CACHED
+        case Engine::AOT:
+            return sizeof(decode_cache) + sizeof(HANDLERS) +
+                   0x1000 * sizeof(AOTBlock const *);
+    }
+
+    return 0;
+}
+
+bool CHIP8::skips_idle(Engine const engine) {
+#ifdef CHIP8_PROFILE
+    // Same as fast_forward()
+    return false;
+#endif
+
+    // Compiled JIT blocks never reach the interpreters' jumps
+    return engine != Engine::JIT;
+}
+
+void CHIP8::write_memory(uint16_t const address, uint8_t const *src,
+                         size_t const size) {
+    // Wraps past 0xFFF like the fetch, so in at most two parts
+    uint16_t const start = address & 0x0FFF;
+    size_t const first {std::min(size, sizeof(state.memory) - start)};
+    std::memcpy(state.memory + start, src, first);
+    invalidate_code(start, first);
+
+    if (first < size) {
+        std::memcpy(state.memory, src + first, size - first);
+        invalidate_code(0, size - first);
+    }
+}
+
+void CHIP8::invalidate_code(uint16_t const address, size_t const size) {
+    // The entries starting one byte before the write decode the first
+    // byte, fused ones reach up to FUSED_REACH bytes further
+    for (size_t i {0}; i <= size + FUSED_REACH; i++) {
+        decode_cache[(address - 1 - FUSED_REACH + i) & 0x0FFF].op =
+            Op::UNDECODED;
+    }
+
+    if (jit_slot.jit) {
+        jit_slot.jit->invalidate(address, size);
+    }
+
+    if (!aot_blocks.empty()) {
+        AOT::invalidate(*this, address, size);
+    }
+}
+
+uint16_t CHIP8::fetch() {
+    state.pc += 2;
+    return (static_cast<uint16_t>(state.memory[state.pc - 2] << 8) |
+    static_cast<uint16_t>(state.memory[state.pc - 1]));
+}
+
+void CHIP8::save_state(State &out) const {
+    out = state;
+}
+
+void CHIP8::load_state(State const& in) {
+    // Only drop decoded and compiled code where memory actually differs
+    size_t constexpr CHUNK {64};
+
+    for (size_t i {0}; i < sizeof(state.memory); i += CHUNK) {
+        if (std::memcmp(state.memory + i, in.memory + i, CHUNK) != 0) {
+            invalidate_code(static_cast<uint16_t>(i), CHUNK);
+        }
+    }
+
+    state = in;
+
+    // Show the restored screen right away instead of on the next tick
+    std::copy(std::begin(state.display_buffer),
+              std::end(state.display_buffer), std::begin(presented.rows));
+    dirty_rows = 0;
+    publish();
+}
+
+namespace {
+
+// Little endian writer and reader for the snapshot format
+struct Writer {
+    uint8_t *p;
+
+    void bytes(void const *src, size_t const size) {
+        std::memcpy(p, src, size);
+        p += size;
+    }
+
+    void u8(uint8_t const v) {
+        *p++ = v;
+    }
+
+    void u16(uint16_t const v) {
+        u8(v & 0xFF);
+        u8(v >> 8);
+    }
+
+    void u64(uint64_t const v) {
+        for (int i {0}; i < 8; i++) {
+            u8(static_cast<uint8_t>(v >> (8 * i)));
+        }
+    }
+};
+
+struct Reader {
+    uint8_t const *p;
+
+    void bytes(void *dst, size_t const size) {
+        std::memcpy(dst, p, size);
+        p += size;
+    }
+
+    uint8_t u8() {
+        return *p++;
+    }
+
+    uint16_t u16() {
+        uint16_t const lo {u8()};
+        return static_cast<uint16_t>(lo | u8() << 8);
+    }
+
+    uint64_t u64() {
+        uint64_t v {0};
+
+        for (int i {0}; i < 8; i++) {
+            v |= static_cast<uint64_t>(u8()) << (8 * i);
+        }
+
+        return v;
+    }
+};
+
+// Must match the header counted in SERIALIZED_SIZE
+uint8_t constexpr STATE_MAGIC[4] {'C', '8', 'S', 'T'};
+uint16_t constexpr STATE_VERSION {3};
+
+} // namespace
+
+void CHIP8::serialize(State const& in, uint8_t *out) {
+    Writer w {out};
+
+    w.bytes(STATE_MAGIC, sizeof(STATE_MAGIC));
+    w.u16(STATE_VERSION);
+    w.bytes(in.memory, sizeof(in.memory));
+    w.bytes(in.registers, sizeof(in.registers));
+
+    for (uint16_t const address : in.stack) {
+        w.u16(address);
+    }
+
+    w.u16(in.pc);
+    w.u16(in.I);
+    w.u8(in.sp);
+    w.u8(in.delay_timer);
+    w.u8(in.sound_timer);
+
+    uint64_t accum_bits;
+    std::memcpy(&accum_bits, &in.accum_time, sizeof(accum_bits));
+    w.u64(accum_bits);
+    w.u64(in.frames);
+    w.u64(in.cycles);
+    w.u64(in.rng);
+    w.u8(in.vip_random);
+
+    for (uint64_t const row : in.display_buffer) {
+        w.u64(row);
+    }
+}
+
+bool CHIP8::deserialize(uint8_t const *in, size_t const size, State &out) {
+    if (size < SERIALIZED_SIZE ||
+        std::memcmp(in, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0) {
+        return false;
+    }
+
+    Reader r {in + sizeof(STATE_MAGIC)};
+
+    if (r.u16() != STATE_VERSION) {
+        return false;
+    }
+
+    r.bytes(out.memory, sizeof(out.memory));
+    r.bytes(out.registers, sizeof(out.registers));
+
+    for (uint16_t &address : out.stack) {
+        address = r.u16();
+    }
+
+    out.pc = r.u16();
+    out.I = r.u16();
+    out.sp = r.u8() & 0xF;
+    out.delay_timer = r.u8();
+    out.sound_timer = r.u8();
+
+    uint64_t const accum_bits {r.u64()};
+    std::memcpy(&out.accum_time, &accum_bits, sizeof(accum_bits));
+    out.frames = r.u64();
+    out.cycles = r.u64();
+    out.rng = r.u64();
+    out.vip_random = r.u8();
+
+    for (uint64_t &row : out.display_buffer) {
+        row = r.u64();
+    }
+
+    return true;
+}
+
+uint64_t CHIP8::display_generation() const {
+    return presented.generation;
+}
+
+uint64_t CHIP8::frame_count() const {
+    return state.frames;
+}
+
+uint64_t CHIP8::cycle_count() const {
+    return state.cycles;
+}
+
+uint64_t CHIP8::skipped_count() const {
+    return skipped_cycles;
+}
+
+uint64_t CHIP8::frame_hash() const {
+    // FNV-1a over the presented display, one byte per pixel
+    uint64_t hash {0xCBF29CE484222325};
+
+    for (int y {0}; y < DISPLAY_HEIGHT; y++) {
+        for (int x {0}; x < DISPLAY_WIDTH; x++) {
+            hash ^= pixel(x, y);
+            hash *= 0x100000001B3;
+        }
+    }
+
+    return hash;
+}
+
+bool CHIP8::pixel(int const x, int const y) const {
+    return presented.pixel(x, y);
+}
+
+bool CHIP8::Frame::pixel(int const x, int const y) const {
+    return (rows[y] >> (DISPLAY_WIDTH - 1 - x)) & 0x1;
+}
+
+void CHIP8::seed(uint64_t const seed) {
+    state.rng = seeded(seed);
+}
+
+uint64_t CHIP8::seeded(uint64_t const seed) {
+    uint64_t rng {0};
+    next_random(rng);
+    rng += seed;
+    next_random(rng);
+    return rng;
+}
+
+uint32_t CHIP8::next_random(uint64_t &rng) {
+    // PCG32, XSH RR output
+    uint64_t const old {rng};
+    rng = old * 6364136223846793005ULL + 1442695040888963407ULL;
+    uint32_t const xorshifted {
+        static_cast<uint32_t>(((old >> 18) ^ old) >> 27)};
+    uint32_t const rot {static_cast<uint32_t>(old >> 59)};
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+}
+
+void CHIP8::pause() {
+    is_paused = true;
+}
+
+void CHIP8::resume() {
+    is_paused = false;
+}
+
 void CHIP8::timer_tick(int const t) {
-    delay_timer = std::max(0, delay_timer - t);
-    sound_timer = std::max(0, sound_timer - t);
+    state.delay_timer = std::max(0, state.delay_timer - t);
+    state.sound_timer = std::max(0, state.sound_timer - t);
 };
 
@@ -1,12 +1,25 @@
+#include <array>
 #include <cstddef>
 #include <cstdint>
-#include <stack>
+#include "spsc_queue.h"
+#include "triple_buffer.h"
+#include <functional>
+#include <iosfwd>
+#include <memory>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #pragma once
 
 struct OPCodeTester;
+class JIT;
+class AOT;
+struct AOTBlock;
+class CHIP8Batch;
+class Tracer;
 
 
 class CHIP8 {
@@ -15,8 +28,29 @@ public:
     static int const DISPLAY_HEIGHT{32};
     static int const SPRITE_WIDTH{8};
     static int constexpr REFRESH_RATE {500};
+
+    // Instructions per emulated second, the timers tick 60 times in that
+    // many instructions. Must be positive.
+    int ips {REFRESH_RATE};
     static std::unordered_map<char, int> const KEYMAP;
 
+    // Named quirk profiles each run on an interpreter of their own, built
+    // with the quirks fixed. RUNTIME tests the flags below instead, for
+    // experimenting. Picked up by run_rom() or select_quirks(), which set
+    // the flags to match a named profile; leave them alone afterwards.
+    enum class Quirks {
+        RUNTIME,
+        // The original interpreter
+        COSMAC_VIP,
+        // HP48 calculators, loads and stores still move I, though by one
+        // less than the VIP did
+        CHIP48,
+        // SUPER-CHIP 1.1
+        SUPER_CHIP,
+        COUNT,
+    };
+    Quirks quirks {Quirks::RUNTIME};
+
     // Legacy sets PC to NNN + V0, otherwise NNN + VX
     bool USE_LEGACY_JUMP{true};
     // Legacy first sets VX = VY
@@ -26,13 +60,155 @@ public:
     // Legacy increments the I register
     bool USE_LEGACY_LOAD_STORE{true};
 
+    // How instructions are dispatched, all engines share the same semantics
+    enum class Engine {
+        // Fetch and walk the opcode switch every cycle
+        SWITCH,
+        // Decode every address once and dispatch through a handler table
+        CACHED,
+        // Translate basic blocks to native code, falls back to CACHED on
+        // hosts without JIT support
+        JIT,
+        // Decoded like CACHED, but every handler jumps straight to the
+        // next one through a label table. Needs computed goto (GCC, Clang)
+        THREADED,
+        // Look the whole 16-bit opcode up in a table built at compile time,
+        // one handler per opcode, without decoding or a cache
+        TABLE,
+        // Run blocks translated to C++ ahead of time for the loaded ROM,
+        // see aot.h. Runs as CACHED where there are none.
+        AOT,
+    };
+    Engine engine {Engine::CACHED};
+    // Bytes of the tables and caches an engine dispatches through, compiled
+    // code not counted
+    static size_t dispatch_bytes(Engine const engine);
+    // Whether run() fast-forwards idle loops on the engine in this build
+    static bool skips_idle(Engine const engine);
+
+    // Where RND gets its numbers from
+    enum class Random {
+        // Per machine PCG generator, set with seed() and kept in snapshots
+        PCG,
+        // Like the COSMAC VIP interpreter, a running byte that adds the
+        // byte of code an instruction counter points at
+        VIP,
+    };
+    Random random {Random::PCG};
+
     friend struct OPCodeTester;
+    friend class JIT;
+    friend class AOT;
+    friend class CHIP8Batch;
+
+    // Everything needed to resume the machine exactly where it left off.
+    // Trivially copyable, so a snapshot is a plain copy. Key states are
+    // host input and not part of it.
+    struct State {
+        uint8_t memory[4096] {};
+        uint8_t registers[16] {};
+        uint16_t stack[16] {};
+        uint16_t pc {};
+        uint16_t I {};
+        // Wraps around after 16 nested calls
+        uint8_t sp {};
+        uint8_t delay_timer {60};
+        uint8_t sound_timer {};
+
+        double accum_time {};
+        uint64_t frames {};
+        // Instructions executed, drives the VIP generator
+        uint64_t cycles {};
+
+        // PCG state, and the running byte of the VIP generator
+        uint64_t rng {};
+        uint8_t vip_random {};
+
+        // The screen as drawn so far, one word per row, the leftmost pixel
+        // is the most significant bit. It is presented on every 60Hz tick.
+        uint64_t display_buffer[DISPLAY_HEIGHT] {};
+    };
+    static_assert(std::is_trivially_copyable_v<State>);
+
+    // Bytes written by serialize()
+    static size_t constexpr SERIALIZED_SIZE {
+        4 + 2                           // magic, version
+        + 4096 + 16                     // memory, registers
+        + 16 * 2 + 2 + 2 + 1            // stack, pc, I, sp
+        + 1 + 1                         // delay and sound timer
+        + 8 + 8 + 8                     // accum_time, frames, cycles
+        + 8 + 1                         // rng, vip_random
+        + DISPLAY_HEIGHT * 8            // display_buffer
+    };
 
-    bool display[DISPLAY_HEIGHT][DISPLAY_WIDTH];
-    bool display_buffer[DISPLAY_HEIGHT][DISPLAY_WIDTH];
-    // Do NOT touch this or the race will condition you
+    // A presented screen, laid out like State::display_buffer
+    struct Frame {
+        uint64_t rows[DISPLAY_HEIGHT] {};
+        // Advances with every frame that differs from the one before
+        uint64_t generation {};
+
+        bool pixel(int const x, int const y) const;
+    };
+
+    // Every frame that changes the screen is published here as it is
+    // presented. Another thread, like a renderer, may acquire frames
+    // while this one runs the machine, neither ever waits for the other.
+    TripleBuffer<Frame> output {};
+
+    // A key going down or up, stamped by the sender in nanoseconds on a
+    // monotonic clock
+    struct KeyEvent {
+        uint64_t time;
+        uint8_t key;
+        bool pressed;
+    };
+
+    // The only member another thread may touch, e.g. a window thread
+    // sending key presses. Drained by apply_input().
+    SPSCQueue<KeyEvent, 256> key_events {};
+
+    // Pressed keys, one bit per key. Owned by the thread running the
+    // machine, other threads send key_events instead.
     uint16_t keystates {};
 
+#ifdef CHIP8_PROFILE
+    // Kinds of instruction told apart by the decoder
+    static size_t constexpr OP_KINDS {36};
+
+    // Execution counters, only built with CHIP8_PROFILE. Compiled code is
+    // not instrumented, so the JIT engine runs as CACHED while profiling.
+    struct Profile {
+        // Executions of each kind of instruction
+        uint64_t ops[OP_KINDS] {};
+        // Executions at each address
+        uint64_t pcs[4096] {};
+        uint64_t draws {};
+        uint64_t draw_ns {};
+        // Fx0A executions that found no key down and wait another cycle
+        uint64_t key_wait_cycles {};
+        // Jumps to themselves, the usual idle loop
+        uint64_t self_jumps {};
+
+        void clear();
+        // The hottest addresses are listed, most executed first
+        void report_text(std::ostream &os, size_t const hotspots = 16) const;
+        void report_json(std::ostream &os, size_t const hotspots = 16) const;
+    };
+    Profile profile {};
+#endif
+
+#ifdef CHIP8_TRACE
+    // Receives every executed instruction while set, only built with
+    // CHIP8_TRACE. Copies of the machine share it, so only one of them
+    // should run while it is set. The JIT engine runs as CACHED meanwhile.
+    Tracer *tracer {nullptr};
+#endif
+
+    // Called once per 60Hz frame, after the instruction during which the
+    // display was updated, so the machine is between instructions. While
+    // set, run() steps one cycle at a time.
+    std::function<void(CHIP8 &)> on_frame {};
+
     CHIP8();
     ~CHIP8() = default;
     CHIP8(const CHIP8 &other) noexcept = default;
@@ -41,24 +217,79 @@ public:
     CHIP8(CHIP8&& other) noexcept = default;
     CHIP8& operator=(CHIP8&& other) noexcept = default;
 
-    void run_rom(std::string const& path);
+    // Returns false if the file could not be opened
+    bool run_rom(std::string const& path);
+    // Switches the interpreter to the quirks profile, setting the flags to
+    // match a named one
+    void select_quirks();
     void cycle(bool const force = false);
+    // Same as calling cycle() the given number of times, but lets the
+    // engine batch work. Returns the number of cycles executed.
+    uint64_t run(uint64_t const cycles);
+    // Runs up to and including the instruction that presents the next
+    // 60Hz frame. Returns the number of cycles executed. Key events are
+    // applied first, up to the given time.
+    uint64_t run_frame(uint64_t const input_until = UINT64_MAX);
+
+    // Applies queued key events stamped up to the given time. May be called
+    // between any two instructions. A key released in the same call that
+    // pressed it stays down until the next call, so presses shorter than
+    // the polling interval are still seen.
+    void apply_input(uint64_t const until = UINT64_MAX);
     uint16_t fetch();
 
+    // Whether the pixel is lit on the presented display
+    bool pixel(int const x, int const y) const;
+
+    // Number of 60Hz frames presented since the machine was created
+    uint64_t frame_count() const;
+    // Instructions executed since the machine was created
+    uint64_t cycle_count() const;
+    // Of those, the ones idle loops were fast-forwarded through rather
+    // than run, counted since the machine was created
+    uint64_t skipped_count() const;
+    // Hash of the presented display, stable across runs and hosts
+    uint64_t frame_hash() const;
+    // Changes whenever the presented display does, so frontends can skip
+    // redrawing identical frames
+    uint64_t display_generation() const;
+
     void pause();
     void resume();
 
+    // Restart the PCG generator, equal seeds give equal runs
+    void seed(uint64_t const seed);
+
+    // Snapshots never allocate
+    void save_state(State &out) const;
+    void load_state(State const& in);
+
+    // Versioned little endian format, out must hold SERIALIZED_SIZE bytes.
+    // deserialize returns false if the data is not a snapshot.
+    static void serialize(State const& in, uint8_t *out);
+    static bool deserialize(uint8_t const *in, size_t const size, State &out);
+
 private:
-    uint8_t memory[4096];
-    uint16_t pc {};
-    uint16_t I {};
-    std::stack<uint16_t> stack {};
-    uint8_t delay_timer {60};
-    uint8_t sound_timer {};
-    uint8_t registers[16];
-
-    double accum_time {};
+    State state {};
     bool is_paused {false};
+    // Set when the timers present a frame, cleared once on_frame has run
+    bool frame_ready {false};
+    // Keys released right after being pressed, let go on the next
+    // apply_input
+    uint16_t pending_release {0};
+
+    // Cycle count the current run() ends at, 0 outside of it. Idle loops
+    // are skipped and fused sequences run only up to here.
+    uint64_t run_end {0};
+    // Cycles run beyond one per dispatch that way
+    uint64_t extra_cycles {0};
+    // Skipped ones only, never reset
+    uint64_t skipped_cycles {0};
+
+    // Rows of display_buffer drawn to since the last presented frame
+    uint32_t dirty_rows {0};
+    // Last frame presented, kept on this side of output
+    Frame presented {};
 
     enum OpMask : uint16_t {
         W = 0xF000,
@@ -69,8 +300,193 @@ private:
         NNN = 0x0FFF,
     };
 
+    // Instruction kinds, UNDECODED marks an empty decode cache entry
+    enum class Op : uint8_t {
+        UNDECODED,
+        NOP,
+        CLS,
+        RET,
+        JP,
+        JP_V0,
+        CALL,
+        SE_VX_NN,
+        SNE_VX_NN,
+        SE_VX_VY,
+        SNE_VX_VY,
+        LD_VX_NN,
+        ADD_VX_NN,
+        LD_I,
+        DRW,
+        RND,
+        LD_VX_VY,
+        OR,
+        AND,
+        XOR,
+        ADD_VX_VY,
+        SUB,
+        SHR,
+        SUBN,
+        SHL,
+        SKP,
+        SKNP,
+        LD_VX_DT,
+        LD_DT_VX,
+        LD_ST_VX,
+        ADD_I_VX,
+        LD_VX_K,
+        LD_F_VX,
+        LD_B_VX,
+        LD_I_VX,
+        LD_VX_I,
+        // Sequences fused into one dispatch, only ever in the decode cache.
+        // The entry holds the fields of the first instruction, the rest
+        // are read from the entries after it.
+        LD_I_DRW,
+        LD_VX_NN_LD_VY_NN,
+        // A counting loop, 7XNN 3XNN 1NNN back to the add
+        ADD_SE_JP,
+        LD_I_LD_VX_I,
+        COUNT,
+    };
+    static Op constexpr FIRST_FUSED {Op::LD_I_DRW};
+    // Bytes a fused entry may cover past its own instruction
+    static size_t constexpr FUSED_REACH {4};
+#ifdef CHIP8_PROFILE
+    static_assert(static_cast<size_t>(FIRST_FUSED) == OP_KINDS);
+#endif
+
+    // An opcode with its operand fields already extracted
+    struct Instr {
+        Op op;
+        uint8_t X;
+        uint8_t Y;
+        uint8_t N;
+        uint8_t NN;
+        uint16_t NNN;
+    };
+
+    using Handler = void (CHIP8::*)(Instr const&);
+    using HandlerTable = std::array<Handler, static_cast<size_t>(Op::COUNT)>;
+    // One table per quirk profile, in the order of Quirks
+    static std::array<HandlerTable, static_cast<size_t>(Quirks::COUNT)> const
+        HANDLERS;
+
+    // Quirk profile the interpreters were picked for by run_rom()
+    Quirks active_quirks {Quirks::RUNTIME};
+
+    // One entry per address, even and odd, since jumps may land on either
+    Instr decode_cache[4096] {};
+
+    static Instr decode(uint16_t const op);
+    static constexpr Op decode_op(uint16_t const op);
+    // Enumerator name, like "LD_VX_NN"
+    static char const *op_name(Op const op);
+    // Fields of the opcode, with op left as NOP
+    static Instr operands(uint16_t const op);
+    // Decodes into the cache, fusing the entry with the instructions after
+    // it where they form a known sequence
+    Instr decode_at(uint16_t const address);
+    // Decodes into the cache without fusing, unless already decoded
+    Instr const& decoded(uint16_t const address);
+    // PCG32 steps, shared with CHIP8Batch
+    static uint64_t seeded(uint64_t const seed);
+    static uint32_t next_random(uint64_t &rng);
+
+    // Semantics of every opcode against a machine view, see semantics.h
+    template <Op OP, typename Machine>
+    static void execute(Machine &&m, Instr const& in);
+    template <typename Q>
+    struct Self;
+
+    template <Op OP, typename Q>
+    void exec(Instr const& in);
+    template <Op OP, typename Q>
+    void exec_fused(Instr const& in);
+    // Starts the next cycle of a fused sequence, false if it would tick
+    // the timers or pass the end of the run
+    bool fuse_next();
+    template <Op OP, typename Q>
+    static constexpr Handler handler();
+    template <typename Q, size_t... OPS>
+    static constexpr HandlerTable make_handlers(std::index_sequence<OPS...>);
+
+    // One handler per opcode for the TABLE engine, per quirk profile. Plain
+    // function pointers, half the size of member ones.
+    using OpcodeHandler = void (*)(CHIP8 &, Instr const&);
+    using OpcodeTable = std::array<OpcodeHandler, 0x10000>;
+    static std::array<OpcodeTable, static_cast<size_t>(Quirks::COUNT)> const
+        OPCODE_TABLES;
+    template <Op OP, typename Q>
+    static void call(CHIP8 &c, Instr const& in);
+    template <typename Q, size_t... OPS>
+    static constexpr OpcodeTable make_opcode_table(
+        std::index_sequence<OPS...>);
+
+    // Quirks as the active profile applies them, for code that bakes them in
+    struct QuirkFlags {
+        bool jump;
+        bool shift;
+        bool index_add;
+        bool load_store;
+    };
+    QuirkFlags quirk_flags();
+    // Calls fn with an instance of the active profile's quirks type
+    template <typename F>
+    decltype(auto) with_quirks(F &&fn);
+
+    // Compiled code is tied to this machine's memory, so copies start
+    // without any and compile their own
+    struct JITSlot {
+        std::unique_ptr<JIT> jit;
+
+        JITSlot();
+        ~JITSlot();
+        JITSlot(JITSlot const&);
+        JITSlot& operator=(JITSlot const&);
+        JITSlot(JITSlot&&) noexcept;
+        JITSlot& operator=(JITSlot&&) noexcept;
+    };
+    JITSlot jit_slot {};
+
+    JIT *jit();
+
+    // Ahead of time compiled block starting at each address, empty when
+    // none were registered for the ROM
+    std::vector<AOTBlock const *> aot_blocks {};
+
+    bool use_aot() const;
+
+    void advance_timers();
+    // Skips ahead while the next instructions only wait, for a key or for
+    // the delay timer, leaving the state as running them would
+    void fast_forward();
+    uint64_t skip_idle(uint64_t const length);
+    // Presents display_buffer, publishing it to output if it changed
+    void present();
+    void publish();
+    // Steps with the active profile, each engine loop below is built once
+    // per profile
+    void step();
+    template <typename Q>
+    void step_with();
+    template <typename Q>
+    void step_switch();
+    template <typename Q>
+    void step_cached();
+    template <typename Q>
+    void step_table();
+    template <typename Q>
+    uint64_t run_stepped(uint64_t const cycles);
+    template <typename Q>
+    uint64_t run_threaded(uint64_t const cycles);
+
+    // All stores into memory go through here to keep the decode cache valid
+    void write_memory(uint16_t const address, uint8_t const *src,
+                      size_t const size);
+    // Drop decoded and compiled code covering the range
+    void invalidate_code(uint16_t const address, size_t const size);
+
     std::byte to_byte(int const value);
-    void draw(uint16_t const X, uint16_t const Y, uint16_t const N);
     void timer_tick(int);
 };
 
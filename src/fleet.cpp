@@ -0,0 +1,357 @@
+#include "chip8.h"
+#include "options.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Runs a corpus of ROMs on every core and reports one line per ROM.
+//
+// A ROM may come with an input script next to it, the same path with the
+// extension replaced by .keys. Every line holds a frame number and the
+// key states from that frame on as a hex mask, # starts a comment:
+//
+//   0    0000
+//   120  0020    # hold key 5
+//   130  0000
+
+namespace fs = std::filesystem;
+
+namespace {
+
+void usage(char const *name) {
+    std::cerr << "Usage: " << name
+              << " <rom|dir>... [--cycles N | --frames N] [--engine E]\n"
+              << "       [--threads N] [--pin]\n"
+              << "Engines: " << ENGINE_NAMES << std::endl;
+}
+
+struct KeyEvent {
+    uint64_t frame;
+    uint16_t keys;
+};
+
+struct Job {
+    std::string rom;
+    std::vector<KeyEvent> script;
+    // Why the input script could not be read, the ROM is then not run
+    std::string error;
+};
+
+struct Result {
+    bool ok {false};
+    uint64_t frame_hash {0};
+    uint64_t cycles {0};
+    uint64_t frames {0};
+    double seconds {0};
+};
+
+struct Settings {
+    CHIP8::Engine engine {CHIP8::Engine::CACHED};
+    uint64_t cycles {0};
+    uint64_t frames {0};
+};
+
+bool load_script(fs::path const& path, std::vector<KeyEvent> &script,
+                 std::string &error) {
+    std::ifstream ifs(path);
+
+    if (!ifs.is_open()) {
+        return false;
+    }
+
+    std::string line;
+
+    for (int number {1}; std::getline(ifs, line); number++) {
+        std::istringstream fields {line.substr(0, line.find('#'))};
+        std::string frame;
+        std::string keys;
+        std::string rest;
+
+        if (!(fields >> frame)) {
+            continue;
+        }
+
+        KeyEvent event {};
+
+        if (!(fields >> keys) || fields >> rest ||
+            !parse_number(frame, event.frame) ||
+            !parse_number(keys, event.keys, 16)) {
+            error = path.string() + ":" + std::to_string(number) + ": " + line;
+            return false;
+        }
+
+        script.push_back(event);
+    }
+
+    std::stable_sort(script.begin(), script.end(),
+                     [](KeyEvent const& a, KeyEvent const& b) {
+                         return a.frame < b.frame;
+                     });
+    return true;
+}
+
+void add_rom(fs::path const& path, std::vector<Job> &jobs) {
+    Job job {path.string(), {}, {}};
+    load_script(fs::path{path}.replace_extension(".keys"), job.script,
+                job.error);
+    jobs.push_back(std::move(job));
+}
+
+Result run_job(Job const& job, Settings const& settings) {
+    Result result {};
+
+    if (!job.error.empty()) {
+        return result;
+    }
+
+    CHIP8 chip8 {};
+    chip8.engine = settings.engine;
+
+    auto const start {std::chrono::steady_clock::now()};
+
+    if (!chip8.run_rom(job.rom)) {
+        return result;
+    }
+
+    size_t next {0};
+
+    while (true) {
+        // Key changes land on frame boundaries
+        while (next < job.script.size() &&
+               job.script[next].frame <= chip8.frame_count()) {
+            chip8.keystates = job.script[next++].keys;
+        }
+
+        uint64_t budget {0};
+
+        if (settings.frames) {
+            if (chip8.frame_count() >= settings.frames) {
+                break;
+            }
+
+            budget = (settings.frames - chip8.frame_count()) *
+                     CHIP8::REFRESH_RATE / 60;
+        } else {
+            if (result.cycles >= settings.cycles) {
+                break;
+            }
+
+            budget = settings.cycles - result.cycles;
+        }
+
+        // Stop at the next key change, a frame early at most
+        if (next < job.script.size()) {
+            budget = std::min(budget, (job.script[next].frame -
+                                       chip8.frame_count()) *
+                                          CHIP8::REFRESH_RATE / 60);
+        }
+
+        result.cycles += chip8.run(std::max<uint64_t>(budget, 1));
+    }
+
+    auto const end {std::chrono::steady_clock::now()};
+
+    result.ok = true;
+    result.frame_hash = chip8.frame_hash();
+    result.frames = chip8.frame_count();
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    return result;
+}
+
+// Each worker owns a deque of job indices. It takes work from the back of
+// its own and, once that is empty, steals from the front of the others.
+class Scheduler {
+public:
+    explicit Scheduler(size_t const workers) : queues(workers) {}
+
+    void push(size_t const worker, size_t const job) {
+        Queue &q {queues[worker]};
+        std::lock_guard<std::mutex> lock {q.mutex};
+        q.jobs.push_back(job);
+    }
+
+    // Returns false once every queue is empty, no work is added later
+    bool next(size_t const worker, size_t &job) {
+        for (size_t i {0}; i < queues.size(); i++) {
+            Queue &q {queues[(worker + i) % queues.size()]};
+            std::lock_guard<std::mutex> lock {q.mutex};
+
+            if (q.jobs.empty()) {
+                continue;
+            }
+
+            if (i == 0) {
+                job = q.jobs.back();
+                q.jobs.pop_back();
+            } else {
+                job = q.jobs.front();
+                q.jobs.pop_front();
+            }
+
+            return true;
+        }
+
+        return false;
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> jobs;
+    };
+
+    std::vector<Queue> queues;
+};
+
+void pin_to_cpu(std::thread &thread, size_t const cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    if (pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set)) {
+        std::cerr << "Could not pin worker to CPU " << cpu << std::endl;
+    }
+#else
+    (void) thread;
+    (void) cpu;
+    std::cerr << "CPU pinning is not supported on this platform" << std::endl;
+#endif
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::vector<Job> jobs;
+    Settings settings {};
+    size_t threads {std::max(1u, std::thread::hardware_concurrency())};
+    bool pin {false};
+
+    for (int i {1}; i < argc; i++) {
+        std::string const arg {argv[i]};
+
+        if (arg == "--cycles" && i + 1 < argc &&
+            parse_number(argv[i + 1], settings.cycles)) {
+            i++;
+        } else if (arg == "--frames" && i + 1 < argc &&
+                   parse_number(argv[i + 1], settings.frames)) {
+            i++;
+        } else if (arg == "--threads" && i + 1 < argc &&
+                   parse_number(argv[i + 1], threads)) {
+            threads = std::max<size_t>(1, threads);
+            i++;
+        } else if (arg == "--pin") {
+            pin = true;
+        } else if (arg == "--engine" && i + 1 < argc &&
+                   parse_engine(argv[i + 1], settings.engine)) {
+            i++;
+        } else if (arg.rfind("--", 0) == 0) {
+            usage(argv[0]);
+            return 1;
+        } else if (fs::is_directory(arg)) {
+            // Sorted, so the report order does not depend on the filesystem
+            std::vector<fs::path> roms;
+
+            for (auto const& entry : fs::directory_iterator{arg}) {
+                if (entry.is_regular_file() &&
+                    entry.path().extension() == ".ch8") {
+                    roms.push_back(entry.path());
+                }
+            }
+
+            std::sort(roms.begin(), roms.end());
+
+            for (auto const& rom : roms) {
+                add_rom(rom, jobs);
+            }
+        } else {
+            add_rom(arg, jobs);
+        }
+    }
+
+    if (jobs.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Default to ten seconds of emulated time
+    if (!settings.cycles && !settings.frames) {
+        settings.cycles = 10 * CHIP8::REFRESH_RATE;
+    }
+
+    threads = std::min(threads, jobs.size());
+
+    Scheduler scheduler {threads};
+    std::vector<Result> results(jobs.size());
+
+    for (size_t i {0}; i < jobs.size(); i++) {
+        scheduler.push(i % threads, i);
+    }
+
+    auto const start {std::chrono::steady_clock::now()};
+
+    std::vector<std::thread> workers;
+    size_t const cpus {std::max(1u, std::thread::hardware_concurrency())};
+
+    for (size_t w {0}; w < threads; w++) {
+        workers.emplace_back([&, w] {
+            size_t job;
+
+            while (scheduler.next(w, job)) {
+                results[job] = run_job(jobs[job], settings);
+            }
+        });
+
+        if (pin) {
+            pin_to_cpu(workers.back(), w % cpus);
+        }
+    }
+
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    auto const end {std::chrono::steady_clock::now()};
+    int failed {0};
+
+    for (size_t i {0}; i < jobs.size(); i++) {
+        Result const& r {results[i]};
+
+        if (!r.ok) {
+            // With the script line at fault, if that was the problem
+            std::printf("%s error%s%s\n", jobs[i].rom.c_str(),
+                        jobs[i].error.empty() ? "" : " ",
+                        jobs[i].error.c_str());
+            failed++;
+            continue;
+        }
+
+        std::printf("%s frame_hash 0x%016llx cycles %llu frames %llu "
+                    "seconds %.6f\n",
+                    jobs[i].rom.c_str(),
+                    static_cast<unsigned long long>(r.frame_hash),
+                    static_cast<unsigned long long>(r.cycles),
+                    static_cast<unsigned long long>(r.frames), r.seconds);
+    }
+
+    std::fprintf(stderr, "%zu roms, %zu threads, %.3f seconds\n", jobs.size(),
+                 threads,
+                 std::chrono::duration<double>(end - start).count());
+
+    return failed ? 1 : 0;
+}
@@ -1,26 +1,58 @@
 #include "graphics.h"
 #include "colors.h"
+#include <GL/freeglut_ext.h>
 #include <GL/freeglut_std.h>
 #include <GL/gl.h>
 #include <GL/glut.h>
 
 namespace graphics {
 
+namespace {
+
+GLuint texture {0};
+bool double_buffer {true};
+
+} // namespace
+
 void init(void (*callback)(int), void (*display)(),
           void (*key_press)(unsigned char, int, int),
-          void (*key_release)(unsigned char, int, int), int argc, char **argv) {
+          void (*key_release)(unsigned char, int, int), int argc, char **argv,
+          bool const double_buffered) {
     glutInit(&argc, argv);
 
-    // Set display mode (single buffer and RGB color)
-    glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB);
+    // Double buffered unless asked otherwise, so every swap presents one
+    // whole frame
+    double_buffer = double_buffered;
+    glutInitDisplayMode((double_buffer ? GLUT_DOUBLE : GLUT_SINGLE) |
+                        GLUT_RGB);
 
     // Set window size
     glutInitWindowSize(1000, 500);
 
+    // Return from the main loop when the window closes, so the caller
+    // can shut down its threads
+    glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_GLUTMAINLOOP_RETURNS);
+
     // Create a window
     glutCreateWindow("CHIP8 Emulator");
     glClearColor(Colors::BG.r, Colors::BG.g, Colors::BG.b, 1.0);
 
+    // The whole display lives in one texture, scaled up without smoothing
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, DISPLAY_WIDTH, DISPLAY_HEIGHT, 0,
+                 GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    glEnable(GL_TEXTURE_2D);
+
+    // Blank until the first frame arrives
+    uint8_t const blank[DISPLAY_WIDTH * DISPLAY_HEIGHT] {};
+    upload(blank);
+
     // Set the display callback
     glutDisplayFunc(display);
 
@@ -34,22 +66,47 @@ void init(void (*callback)(int), void (*display)(),
     glutMainLoop();
 }
 
-void draw_square(int const x, int const y) {
-    // Draw a square using GL_QUADS
-    double const x_orig{2.0f / DISPLAY_WIDTH};
-    double const y_orig{2.0f / DISPLAY_HEIGHT};
+void upload(uint8_t const *pixels) {
+    auto const channel = [](GLfloat const value) {
+        return static_cast<uint8_t>(value * 255.0f + 0.5f);
+    };
+    uint8_t const fg[3] {channel(Colors::FG.r), channel(Colors::FG.g),
+                         channel(Colors::FG.b)};
+    uint8_t const bg[3] {channel(Colors::BG.r), channel(Colors::BG.g),
+                         channel(Colors::BG.b)};
 
-    double const x_offset(2.0f * x / DISPLAY_WIDTH);
-    double const y_offset(2.0f * y / DISPLAY_HEIGHT);
+    uint8_t rgb[DISPLAY_WIDTH * DISPLAY_HEIGHT * 3];
 
+    for (int i {0}; i < DISPLAY_WIDTH * DISPLAY_HEIGHT; i++) {
+        uint8_t const *const color {pixels[i] ? fg : bg};
+        rgb[3 * i] = color[0];
+        rgb[3 * i + 1] = color[1];
+        rgb[3 * i + 2] = color[2];
+    }
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT,
+                    GL_RGB, GL_UNSIGNED_BYTE, rgb);
+}
+
+void present() {
+    glClear(GL_COLOR_BUFFER_BIT);
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+    // The first texture row is the top of the display
+    glColor3f(1.0f, 1.0f, 1.0f);
     glBegin(GL_QUADS);
-    glVertex2f(-1.0f + x_offset, -1.0f + y_offset); // Bottom-left corner
-    glVertex2f(-1.0f + x_offset + x_orig,
-               -1.0f + y_offset); // Bottom-right corner
-    glVertex2f(-1.0f + x_offset + x_orig,
-               -1.0f + y_offset + y_orig);                   // Top-right corner
-    glVertex2f(-1.0f + x_offset, -1.0f + y_offset + y_orig); // Top-left corner
+    glTexCoord2f(0.0f, 1.0f); glVertex2f(-1.0f, -1.0f); // Bottom-left corner
+    glTexCoord2f(1.0f, 1.0f); glVertex2f(1.0f, -1.0f);  // Bottom-right corner
+    glTexCoord2f(1.0f, 0.0f); glVertex2f(1.0f, 1.0f);   // Top-right corner
+    glTexCoord2f(0.0f, 0.0f); glVertex2f(-1.0f, 1.0f);  // Top-left corner
     glEnd();
+
+    if (double_buffer) {
+        glutSwapBuffers();
+    } else {
+        glFlush();
+    }
 }
 
 }; // namespace graphics
@@ -1,16 +1,22 @@
 #include <GL/freeglut_std.h>
 #include <GL/gl.h>
 #include <GL/glut.h>
+#include <cstdint>
 
 namespace graphics {
 
 int const DISPLAY_WIDTH{64};
 int const DISPLAY_HEIGHT{32};
 
+// A single buffered window draws straight to the screen, which may tear
 void init(void (*callback)(int), void (*display)(),
           void (*key_press)(unsigned char, int, int),
-          void (*key_release)(unsigned char, int, int), int argc, char **argv);
+          void (*key_release)(unsigned char, int, int), int argc, char **argv,
+          bool const double_buffered = true);
 void timer(int const refresh_rate);
-void draw_square(int const x, int const);
+// Uploads a frame, one byte per pixel that is nonzero when lit
+void upload(uint8_t const *pixels);
+// Draws the last uploaded frame as one quad scaled to the window
+void present();
 
 } // namespace graphics
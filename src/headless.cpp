@@ -0,0 +1,274 @@
+#include "batch.h"
+#include "chip8.h"
+#include "movie.h"
+#include "opcode_tester.h"
+#include "options.h"
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+
+namespace {
+
+void usage(char const *name) {
+    std::cerr << "Usage: " << name
+              << " <rom> [--cycles N | --frames N] [--engine E | --lanes N]\n"
+              << "       [--seed N] [--random pcg|vip] [--profile text|json]\n"
+              << "       [--trace FILE] [--quirks Q]\n"
+              << "       " << name << " <rom> --replay MOVIE [--engine E]\n"
+              << "       " << name << " --opcode-test [--engine E]\n"
+              << "Engines: " << ENGINE_NAMES << "\n"
+              << "Quirks: " << QUIRKS_NAMES << std::endl;
+}
+
+void print_profile(CHIP8 const& chip8, std::string const& format) {
+#ifdef CHIP8_PROFILE
+    if (format == "json") {
+        chip8.profile.report_json(std::cout);
+    } else if (format == "text") {
+        std::cout << "\n";
+        chip8.profile.report_text(std::cout);
+    }
+#else
+    (void) chip8;
+    (void) format;
+#endif
+}
+
+void print_trace(CHIP8 const& chip8) {
+#ifdef CHIP8_TRACE
+    if (chip8.tracer) {
+        std::printf("trace_dropped %llu\n",
+                    static_cast<unsigned long long>(chip8.tracer->dropped()));
+    }
+#else
+    (void) chip8;
+#endif
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    if (argc <= 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    CHIP8 chip8{};
+
+    uint64_t cycles {0};
+    uint64_t frames {0};
+    // Run this many copies in lockstep through CHIP8Batch instead
+    size_t lanes {0};
+    // Replay a recorded movie instead of running for a set time
+    std::string replay;
+    // Report format of the profile printed after the run, if any
+    std::string profile;
+    // Every instruction is written here
+    std::string trace;
+
+    for (int i {2}; i < argc; i++) {
+        std::string const arg {argv[i]};
+
+        uint64_t seed {0};
+
+        if (arg == "--cycles" && i + 1 < argc &&
+            parse_number(argv[i + 1], cycles)) {
+            i++;
+        } else if (arg == "--frames" && i + 1 < argc &&
+                   parse_number(argv[i + 1], frames)) {
+            i++;
+        } else if (arg == "--seed" && i + 1 < argc &&
+                   parse_number(argv[i + 1], seed)) {
+            chip8.seed(seed);
+            i++;
+        } else if (arg == "--random" && i + 1 < argc &&
+                   (std::string(argv[i + 1]) == "pcg" ||
+                    std::string(argv[i + 1]) == "vip")) {
+            chip8.random = std::string(argv[++i]) == "vip"
+                               ? CHIP8::Random::VIP
+                               : CHIP8::Random::PCG;
+        } else if (arg == "--replay" && i + 1 < argc) {
+            replay = argv[++i];
+        } else if (arg == "--profile" && i + 1 < argc &&
+                   (std::string(argv[i + 1]) == "text" ||
+                    std::string(argv[i + 1]) == "json")) {
+            profile = argv[++i];
+        } else if (arg == "--trace" && i + 1 < argc) {
+            trace = argv[++i];
+        } else if (arg == "--lanes" && i + 1 < argc &&
+                   parse_number(argv[i + 1], lanes)) {
+            i++;
+        } else if (arg == "--engine" && i + 1 < argc &&
+                   parse_engine(argv[i + 1], chip8.engine)) {
+            i++;
+        } else if (arg == "--quirks" && i + 1 < argc &&
+                   parse_quirks(argv[i + 1], chip8.quirks)) {
+            i++;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Run the test module without needing a window
+    if (std::string(argv[1]) == "--opcode-test") {
+        OPCodeTester tester {};
+        tester.run(chip8);
+        return 0;
+    }
+
+    if (!profile.empty() && lanes) {
+        std::cerr << "--profile covers single machines, not --lanes"
+                  << std::endl;
+        return 1;
+    }
+
+#ifndef CHIP8_PROFILE
+    if (!profile.empty()) {
+        std::cerr << "Built without CHIP8_PROFILE, configure with "
+                  << "-DCHIP8_PROFILE=ON" << std::endl;
+        return 1;
+    }
+#endif
+
+    if (!trace.empty() && lanes) {
+        std::cerr << "--trace covers single machines, not --lanes"
+                  << std::endl;
+        return 1;
+    }
+
+#ifdef CHIP8_TRACE
+    std::unique_ptr<Tracer> tracer;
+
+    if (!trace.empty()) {
+        tracer = std::make_unique<Tracer>(trace);
+
+        if (!tracer->ok()) {
+            std::cerr << "Could not create trace " << trace << std::endl;
+            return 1;
+        }
+
+        chip8.tracer = tracer.get();
+    }
+#else
+    if (!trace.empty()) {
+        std::cerr << "Built without CHIP8_TRACE, configure with "
+                  << "-DCHIP8_TRACE=ON" << std::endl;
+        return 1;
+    }
+#endif
+
+    // Default to ten seconds of emulated time
+    if (!cycles && !frames) {
+        cycles = 10 * CHIP8::REFRESH_RATE;
+    }
+
+    if (!chip8.run_rom(argv[1])) {
+        return 1;
+    }
+
+    if (!replay.empty()) {
+        Movie movie {};
+
+        if (!movie.load(replay)) {
+            std::cerr << "Could not read movie " << replay << std::endl;
+            return 1;
+        }
+
+        if (!movie.setup(chip8)) {
+            std::cerr << "Movie was recorded with another ROM" << std::endl;
+            return 1;
+        }
+
+        auto const start{std::chrono::steady_clock::now()};
+        bool const match {movie.replay(chip8)};
+        auto const end{std::chrono::steady_clock::now()};
+        double const elapsed {
+            std::chrono::duration<double>(end - start).count()};
+
+        std::printf("frame_hash 0x%016llx\n",
+                    static_cast<unsigned long long>(chip8.frame_hash()));
+        std::printf("cycles %llu\n",
+                    static_cast<unsigned long long>(chip8.cycle_count()));
+        std::printf("frames %llu\n",
+                    static_cast<unsigned long long>(chip8.frame_count()));
+        std::printf("inputs %zu\n", movie.inputs.size());
+        std::printf("seconds %.6f\n", elapsed);
+        std::printf("ips %.0f\n",
+                    elapsed > 0 ? chip8.cycle_count() / elapsed : 0.0);
+        std::printf("replay %s\n", match ? "match" : "mismatch");
+        print_trace(chip8);
+        print_profile(chip8, profile);
+
+        return match ? 0 : 1;
+    }
+
+    if (lanes) {
+        CHIP8Batch batch {chip8, lanes};
+
+        uint64_t executed {0};
+        auto const start{std::chrono::steady_clock::now()};
+
+        if (frames) {
+            while (batch.frame_count() < frames) {
+                uint64_t const remaining {
+                    (frames - batch.frame_count()) * CHIP8::REFRESH_RATE / 60};
+                executed += batch.run(std::max<uint64_t>(remaining, 1));
+            }
+        } else {
+            executed = batch.run(cycles);
+        }
+
+        auto const end{std::chrono::steady_clock::now()};
+        double const elapsed {
+            std::chrono::duration<double>(end - start).count()};
+
+        std::printf("frame_hash 0x%016llx\n",
+                    static_cast<unsigned long long>(batch.frame_hash(0)));
+        std::printf("cycles %llu\n", static_cast<unsigned long long>(executed));
+        std::printf("frames %llu\n",
+                    static_cast<unsigned long long>(batch.frame_count()));
+        std::printf("lanes %zu\n", lanes);
+        std::printf("uniform %llu\n",
+                    static_cast<unsigned long long>(batch.uniform_cycles));
+        std::printf("seconds %.6f\n", elapsed);
+        std::printf("ips %.0f\n",
+                    elapsed > 0 ? executed * lanes / elapsed : 0.0);
+
+        return 0;
+    }
+
+    uint64_t executed {0};
+    auto const start{std::chrono::steady_clock::now()};
+
+    if (frames) {
+        while (chip8.frame_count() < frames) {
+            // Never more than the cycles the remaining frames take
+            uint64_t const remaining {
+                (frames - chip8.frame_count()) * CHIP8::REFRESH_RATE / 60};
+            executed += chip8.run(std::max<uint64_t>(remaining, 1));
+        }
+    } else {
+        executed = chip8.run(cycles);
+    }
+
+    auto const end{std::chrono::steady_clock::now()};
+    double const elapsed {std::chrono::duration<double>(end - start).count()};
+
+    std::printf("frame_hash 0x%016llx\n",
+                static_cast<unsigned long long>(chip8.frame_hash()));
+    std::printf("cycles %llu\n", static_cast<unsigned long long>(executed));
+    std::printf("frames %llu\n",
+                static_cast<unsigned long long>(chip8.frame_count()));
+    std::printf("seconds %.6f\n", elapsed);
+    std::printf("ips %.0f\n", elapsed > 0 ? executed / elapsed : 0.0);
+    print_trace(chip8);
+    print_profile(chip8, profile);
+
+    return 0;
+}
@@ -0,0 +1,537 @@
+#include "jit.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__unix__)
+#define CHIP8_JIT_SUPPORTED 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define CHIP8_JIT_SUPPORTED 0
+#endif
+
+namespace {
+
+size_t constexpr BUFFER_SIZE {1 << 20};
+// Worst case is a FX65 with X = F, well under this per instruction
+size_t constexpr MAX_INSTR_BYTES {256};
+size_t constexpr MAX_BLOCK_BYTES {JIT::MAX_BLOCK * MAX_INSTR_BYTES + 64};
+
+// x86-64 register numbers
+enum Reg : uint8_t {
+    EAX = 0,
+    ECX = 1,
+    EDX = 2,
+};
+
+// Writes machine code. Every memory operand is [rbx + disp32], with rbx
+// holding the CHIP8 pointer for the whole block.
+struct Emitter {
+    uint8_t *start;
+    uint8_t *p;
+
+    void byte(uint8_t const b) {
+        *p++ = b;
+    }
+
+    void u16(uint16_t const v) {
+        std::memcpy(p, &v, 2);
+        p += 2;
+    }
+
+    void u32(uint32_t const v) {
+        std::memcpy(p, &v, 4);
+        p += 4;
+    }
+
+    void u64(uint64_t const v) {
+        std::memcpy(p, &v, 8);
+        p += 8;
+    }
+
+    // ModRM for [rbx + disp32] with the given reg field
+    void mem(uint8_t const reg, int32_t const disp) {
+        byte(0x80 | (reg << 3) | 0x3);
+        u32(static_cast<uint32_t>(disp));
+    }
+
+    size_t size() const {
+        return p - start;
+    }
+};
+
+#if CHIP8_JIT_SUPPORTED
+// Changes the protection of the pages covering the range. The buffer is
+// writable while a block is emitted and executable after, never both, for
+// hosts that enforce W^X.
+bool protect(uint8_t *const start, size_t const size, int const prot) {
+    uintptr_t const page {static_cast<uintptr_t>(sysconf(_SC_PAGESIZE))};
+    uintptr_t const first {reinterpret_cast<uintptr_t>(start) & ~(page - 1)};
+    uintptr_t const end {reinterpret_cast<uintptr_t>(start) + size};
+    return mprotect(reinterpret_cast<void *>(first), end - first, prot) == 0;
+}
+#endif
+
+} // namespace
+
+bool JIT::Quirks::operator==(Quirks const& other) const {
+    return jump == other.jump && shift == other.shift &&
+           index_add == other.index_add && load_store == other.load_store;
+}
+
+JIT::JIT() {
+#if CHIP8_JIT_SUPPORTED
+    void *const mapped {mmap(nullptr, BUFFER_SIZE,
+                             PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)};
+
+    if (mapped != MAP_FAILED) {
+        buffer = static_cast<uint8_t *>(mapped);
+        capacity = BUFFER_SIZE;
+    }
+#endif
+}
+
+JIT::~JIT() {
+#if CHIP8_JIT_SUPPORTED
+    if (buffer) {
+        munmap(buffer, capacity);
+    }
+#endif
+}
+
+bool JIT::available() const {
+    return buffer != nullptr;
+}
+
+uint64_t JIT::run(CHIP8 &chip8, uint64_t const cycles) {
+    CHIP8::QuirkFlags const flags {chip8.quirk_flags()};
+    Quirks const current {
+        flags.jump,
+        flags.shift,
+        flags.index_add,
+        flags.load_store,
+    };
+
+    if (!(current == quirks)) {
+        flush();
+        quirks = current;
+    }
+
+    uint64_t executed {0};
+
+    while (executed < cycles) {
+        Block const *const block {lookup(chip8, cycles - executed)};
+
+        if (!block) {
+            chip8.advance_timers();
+            chip8.step();
+            executed++;
+            continue;
+        }
+
+        // Only the last instruction of a block can see the timers
+        for (uint16_t i {0}; i < block->length; i++) {
+            chip8.advance_timers();
+        }
+
+        block->code(&chip8);
+        executed += block->length;
+    }
+
+    return executed;
+}
+
+void JIT::invalidate(uint16_t const address, size_t const size) {
+    int const first {std::max(0, address - 2 * static_cast<int>(MAX_BLOCK))};
+    int const last {std::min(0x0FFF, static_cast<int>(address + size) - 1)};
+    size_t const end {address + size};
+
+    for (int start {first}; start <= last; start++) {
+        for (Block *block : {&blocks[start], &singles[start]}) {
+            if (block->code && block->start < end && block->end > address) {
+                block->code = nullptr;
+            }
+        }
+    }
+}
+
+void JIT::flush() {
+    std::fill(std::begin(blocks), std::end(blocks), Block{});
+    std::fill(std::begin(singles), std::end(singles), Block{});
+    used = 0;
+}
+
+JIT::Block const *JIT::lookup(CHIP8 &chip8, uint64_t const budget) {
+    uint16_t const pc {chip8.state.pc};
+
+    // Instructions straddling the end of memory are left to the interpreter
+    if (pc > 0x0FFE) {
+        return nullptr;
+    }
+
+    // Stepping one cycle at a time never runs more than a single, so the
+    // full block is not worth compiling and then protecting
+    if (budget > 1) {
+        if (!blocks[pc].code) {
+            blocks[pc] = compile(chip8, pc, MAX_BLOCK);
+        }
+
+        if (blocks[pc].length <= budget) {
+            return blocks[pc].code ? &blocks[pc] : nullptr;
+        }
+    }
+
+    if (!singles[pc].code) {
+        singles[pc] = compile(chip8, pc, 1);
+    }
+
+    return singles[pc].code ? &singles[pc] : nullptr;
+}
+
+bool JIT::ends_block(CHIP8::Op const op) {
+    using Op = CHIP8::Op;
+
+    switch (op) {
+        // Control flow
+        case Op::JP:
+        case Op::JP_V0:
+        case Op::CALL:
+        case Op::RET:
+        case Op::SE_VX_NN:
+        case Op::SNE_VX_NN:
+        case Op::SE_VX_VY:
+        case Op::SNE_VX_VY:
+        case Op::SKP:
+        case Op::SKNP:
+        case Op::LD_VX_K:
+        // Display, which the timer tick copies
+        case Op::CLS:
+        case Op::DRW:
+        // Timers
+        case Op::LD_VX_DT:
+        case Op::LD_DT_VX:
+        case Op::LD_ST_VX:
+        // The VIP generator reads the cycle count
+        case Op::RND:
+        // Memory writes, which may overwrite the rest of the block
+        case Op::LD_B_VX:
+        case Op::LD_I_VX:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+void JIT::call_exec(CHIP8 *chip8, uint64_t const packed) {
+    CHIP8::Instr in;
+    std::memcpy(&in, &packed, sizeof(in));
+    (chip8->*CHIP8::HANDLERS[static_cast<size_t>(chip8->active_quirks)]
+                            [static_cast<size_t>(in.op)])(in);
+}
+
+JIT::Block JIT::compile(CHIP8 &chip8, uint16_t const start,
+                        size_t const max_length) {
+    using Op = CHIP8::Op;
+    static_assert(sizeof(CHIP8::Instr) == sizeof(uint64_t));
+
+    if (capacity - used < MAX_BLOCK_BYTES) {
+        flush();
+    }
+
+#if CHIP8_JIT_SUPPORTED
+    // Left to the interpreter if the host refuses
+    if (!protect(buffer + used, MAX_BLOCK_BYTES, PROT_READ | PROT_WRITE)) {
+        return {};
+    }
+#endif
+
+    auto const disp = [&chip8](void const *field) {
+        return static_cast<int32_t>(reinterpret_cast<char const *>(field) -
+                                    reinterpret_cast<char const *>(&chip8));
+    };
+    auto const V = [&](int const i) {
+        return disp(&chip8.state.registers[i]);
+    };
+
+    int32_t const PC {disp(&chip8.state.pc)};
+    int32_t const I {disp(&chip8.state.I)};
+    int32_t const VF {V(0xF)};
+
+    Emitter e {buffer + used, buffer + used};
+
+    // push rbx; mov rbx, rdi
+    e.byte(0x53);
+    e.byte(0x48); e.byte(0x89); e.byte(0xFB);
+
+    uint16_t addr {start};
+    uint16_t length {0};
+    bool pc_written {false};
+
+    while (length < max_length && addr <= 0x0FFE) {
+        uint8_t const *const bytes {&chip8.state.memory[addr]};
+        CHIP8::Instr const in {
+            CHIP8::decode(static_cast<uint16_t>(bytes[0] << 8 | bytes[1]))};
+        uint16_t const next {static_cast<uint16_t>(addr + 2)};
+
+        addr = next;
+        length++;
+        pc_written = false;
+
+        switch (in.op) {
+            case Op::NOP:
+                break;
+
+            case Op::JP:
+                // mov word [pc], NNN
+                e.byte(0x66); e.byte(0xC7); e.mem(0, PC); e.u16(in.NNN);
+                pc_written = true;
+                break;
+
+            case Op::SE_VX_NN:
+            case Op::SNE_VX_NN:
+            case Op::SE_VX_VY:
+            case Op::SNE_VX_VY: {
+                if (in.op == Op::SE_VX_NN || in.op == Op::SNE_VX_NN) {
+                    // cmp byte [VX], NN
+                    e.byte(0x80); e.mem(7, V(in.X)); e.byte(in.NN);
+                } else {
+                    // mov al, [VX]; cmp al, [VY]
+                    e.byte(0x8A); e.mem(EAX, V(in.X));
+                    e.byte(0x3A); e.mem(EAX, V(in.Y));
+                }
+
+                // mov eax, next; mov ecx, next + 2; cmove/cmovne eax, ecx
+                e.byte(0xB8); e.u32(next);
+                e.byte(0xB9); e.u32(static_cast<uint16_t>(next + 2));
+                bool const equal {in.op == Op::SE_VX_NN ||
+                                  in.op == Op::SE_VX_VY};
+                e.byte(0x0F); e.byte(equal ? 0x44 : 0x45); e.byte(0xC1);
+
+                // mov [pc], ax
+                e.byte(0x66); e.byte(0x89); e.mem(EAX, PC);
+                pc_written = true;
+                break;
+            }
+
+            case Op::LD_VX_NN:
+                // mov byte [VX], NN
+                e.byte(0xC6); e.mem(0, V(in.X)); e.byte(in.NN);
+                break;
+
+            case Op::ADD_VX_NN:
+                // add byte [VX], NN
+                e.byte(0x80); e.mem(0, V(in.X)); e.byte(in.NN);
+                break;
+
+            case Op::LD_I:
+                // mov word [I], NNN
+                e.byte(0x66); e.byte(0xC7); e.mem(0, I); e.u16(in.NNN);
+                break;
+
+            case Op::LD_VX_VY:
+                // mov al, [VY]; mov [VX], al
+                e.byte(0x8A); e.mem(EAX, V(in.Y));
+                e.byte(0x88); e.mem(EAX, V(in.X));
+                break;
+
+            case Op::OR:
+            case Op::AND:
+            case Op::XOR: {
+                uint8_t const opcode {static_cast<uint8_t>(
+                    in.op == Op::OR ? 0x08 : in.op == Op::AND ? 0x20 : 0x30)};
+
+                // mov al, [VY]; op [VX], al; mov byte [VF], 0
+                e.byte(0x8A); e.mem(EAX, V(in.Y));
+                e.byte(opcode); e.mem(EAX, V(in.X));
+                e.byte(0xC6); e.mem(0, VF); e.byte(0);
+                break;
+            }
+
+            case Op::ADD_VX_VY:
+                // mov al, [VX]; add al, [VY]; mov [VX], al
+                e.byte(0x8A); e.mem(EAX, V(in.X));
+                e.byte(0x02); e.mem(EAX, V(in.Y));
+                e.byte(0x88); e.mem(EAX, V(in.X));
+                // VF = VX < VY, read back after the store like the
+                // interpreter does: mov al, [VX]; cmp al, [VY]; setb dl
+                e.byte(0x8A); e.mem(EAX, V(in.X));
+                e.byte(0x3A); e.mem(EAX, V(in.Y));
+                e.byte(0x0F); e.byte(0x92); e.byte(0xC2);
+                e.byte(0x88); e.mem(EDX, VF);
+                break;
+
+            case Op::SUB:
+                // mov al, [VX]; mov cl, [VY]; cmp al, cl; setae dl
+                e.byte(0x8A); e.mem(EAX, V(in.X));
+                e.byte(0x8A); e.mem(ECX, V(in.Y));
+                e.byte(0x38); e.byte(0xC8);
+                e.byte(0x0F); e.byte(0x93); e.byte(0xC2);
+                // sub al, cl; mov [VX], al; mov [VF], dl
+                e.byte(0x28); e.byte(0xC8);
+                e.byte(0x88); e.mem(EAX, V(in.X));
+                e.byte(0x88); e.mem(EDX, VF);
+                break;
+
+            case Op::SUBN:
+                // mov al, [VX]; mov cl, [VY]; cmp cl, al; setae dl
+                e.byte(0x8A); e.mem(EAX, V(in.X));
+                e.byte(0x8A); e.mem(ECX, V(in.Y));
+                e.byte(0x38); e.byte(0xC1);
+                e.byte(0x0F); e.byte(0x93); e.byte(0xC2);
+                // sub cl, al; mov [VX], cl; mov [VF], dl
+                e.byte(0x28); e.byte(0xC1);
+                e.byte(0x88); e.mem(ECX, V(in.X));
+                e.byte(0x88); e.mem(EDX, VF);
+                break;
+
+            case Op::SHR:
+            case Op::SHL: {
+                // mov al, [VY or VX]; mov cl, al
+                e.byte(0x8A); e.mem(EAX, V(quirks.shift ? in.Y : in.X));
+                e.byte(0x88); e.byte(0xC1);
+
+                if (in.op == Op::SHR) {
+                    // and cl, 1; shr al, 1
+                    e.byte(0x80); e.byte(0xE1); e.byte(0x01);
+                    e.byte(0xD0); e.byte(0xE8);
+                } else {
+                    // shr cl, 7; shl al, 1
+                    e.byte(0xC0); e.byte(0xE9); e.byte(0x07);
+                    e.byte(0xD0); e.byte(0xE0);
+                }
+
+                // mov [VX], al; mov [VF], cl
+                e.byte(0x88); e.mem(EAX, V(in.X));
+                e.byte(0x88); e.mem(ECX, VF);
+                break;
+            }
+
+            case Op::ADD_I_VX:
+                // movzx eax, byte [VX]; add word [I], ax
+                e.byte(0x0F); e.byte(0xB6); e.mem(EAX, V(in.X));
+                e.byte(0x66); e.byte(0x01); e.mem(EAX, I);
+
+                if (quirks.index_add) {
+                    // movzx ecx, word [I]; cmp ecx, eax; setb dl
+                    e.byte(0x0F); e.byte(0xB7); e.mem(ECX, I);
+                    e.byte(0x39); e.byte(0xC1);
+                    e.byte(0x0F); e.byte(0x92); e.byte(0xC2);
+                    e.byte(0x88); e.mem(EDX, VF);
+                }
+                break;
+
+            case Op::LD_F_VX:
+                // movzx eax, byte [VX]; lea eax, [rax + rax * 4 + 0x50]
+                e.byte(0x0F); e.byte(0xB6); e.mem(EAX, V(in.X));
+                e.byte(0x8D); e.byte(0x44); e.byte(0x80); e.byte(0x50);
+                // mov [I], ax
+                e.byte(0x66); e.byte(0x89); e.mem(EAX, I);
+                break;
+
+            case Op::LD_VX_I: {
+                // movzx eax, word [I]
+                e.byte(0x0F); e.byte(0xB7); e.mem(EAX, I);
+
+                for (int i {0}; i <= in.X; i++) {
+                    // lea ecx, [rax + i]; and ecx, 0xFFF, wrapping like
+                    // the interpreter
+                    e.byte(0x8D); e.byte(0x48); e.byte(static_cast<uint8_t>(i));
+                    e.byte(0x81); e.byte(0xE1); e.u32(0x0FFF);
+                    // mov cl, [rbx + rcx + memory]; mov [Vi], cl
+                    e.byte(0x8A); e.byte(0x8C); e.byte(0x0B);
+                    e.u32(static_cast<uint32_t>(
+                        disp(&chip8.state.memory[0])));
+                    e.byte(0x88); e.mem(ECX, V(i));
+                }
+
+                if (quirks.load_store) {
+                    // add word [I], X + 1
+                    e.byte(0x66); e.byte(0x81); e.mem(0, I);
+                    e.u16(static_cast<uint16_t>(in.X + 1));
+                }
+                break;
+            }
+
+            case Op::LD_VX_DT:
+                // mov al, [delay_timer]; mov [VX], al
+                e.byte(0x8A); e.mem(EAX, disp(&chip8.state.delay_timer));
+                e.byte(0x88); e.mem(EAX, V(in.X));
+                break;
+
+            case Op::LD_DT_VX:
+            case Op::LD_ST_VX: {
+                uint8_t const *timer {in.op == Op::LD_DT_VX
+                                      ? &chip8.state.delay_timer
+                                      : &chip8.state.sound_timer};
+
+                // mov al, [VX]; mov [timer], al
+                e.byte(0x8A); e.mem(EAX, V(in.X));
+                e.byte(0x88); e.mem(EAX, disp(timer));
+                break;
+            }
+
+            default: {
+                // Everything else runs through the interpreter's handler,
+                // which expects pc to already point past the instruction
+                uint64_t packed;
+                std::memcpy(&packed, &in, sizeof(packed));
+
+                // mov word [pc], next
+                e.byte(0x66); e.byte(0xC7); e.mem(0, PC); e.u16(next);
+                // mov rdi, rbx; mov rsi, packed
+                e.byte(0x48); e.byte(0x89); e.byte(0xDF);
+                e.byte(0x48); e.byte(0xBE); e.u64(packed);
+                // mov rax, call_exec; call rax
+                e.byte(0x48); e.byte(0xB8);
+                e.u64(reinterpret_cast<uint64_t>(&JIT::call_exec));
+                e.byte(0xFF); e.byte(0xD0);
+
+                // Handlers ending a block leave pc where it should be
+                pc_written = ends_block(in.op);
+                break;
+            }
+        }
+
+        if (ends_block(in.op)) {
+            break;
+        }
+    }
+
+    if (!pc_written) {
+        // mov word [pc], addr
+        e.byte(0x66); e.byte(0xC7); e.mem(0, PC); e.u16(addr);
+    }
+
+    // pop rbx; ret
+    e.byte(0x5B);
+    e.byte(0xC3);
+
+#if CHIP8_JIT_SUPPORTED
+    if (!protect(buffer + used, e.size(), PROT_READ | PROT_EXEC)) {
+        return {};
+    }
+#endif
+
+    Block const block {
+        reinterpret_cast<Code>(buffer + used),
+        start,
+        addr,
+        length,
+    };
+    used += e.size();
+
+    return block;
+}
+
+CHIP8::JITSlot::JITSlot() = default;
+CHIP8::JITSlot::JITSlot(JITSlot const&) {}
+CHIP8::JITSlot::~JITSlot() = default;
+CHIP8::JITSlot::JITSlot(JITSlot&&) noexcept = default;
+CHIP8::JITSlot& CHIP8::JITSlot::operator=(JITSlot&&) noexcept = default;
+
+CHIP8::JITSlot& CHIP8::JITSlot::operator=(JITSlot const&) {
+    jit.reset();
+    return *this;
+}
@@ -0,0 +1,72 @@
+#include "chip8.h"
+#include <cstddef>
+#include <cstdint>
+
+#pragma once
+
+// Translates straight-line CHIP-8 code into x86-64 machine code.
+//
+// A block runs from its start address up to and including the first
+// instruction that branches, skips, draws, waits for a key, writes memory,
+// touches the timers or draws a random number. Nothing before the last
+// instruction of a block can observe the timers or the display, so the
+// timer ticks of the whole block are applied on entry and the results match
+// the interpreter cycle for cycle.
+class JIT {
+public:
+    // Longest block in instructions
+    static size_t constexpr MAX_BLOCK {32};
+
+    JIT();
+    ~JIT();
+    JIT(JIT const&) = delete;
+    JIT& operator=(JIT const&) = delete;
+
+    // False when the host cannot run generated code
+    bool available() const;
+
+    uint64_t run(CHIP8 &chip8, uint64_t const cycles);
+
+    // Drop blocks compiled from any byte in the range
+    void invalidate(uint16_t const address, size_t const size);
+    void flush();
+
+    // Last instruction of a block, also used by the AOT translator
+    static bool ends_block(CHIP8::Op const op);
+
+private:
+    using Code = void (*)(CHIP8 *);
+
+    struct Block {
+        Code code;
+        uint16_t start;
+        uint16_t end;
+        uint16_t length;
+    };
+
+    // Quirks are baked into the generated code
+    struct Quirks {
+        bool jump;
+        bool shift;
+        bool index_add;
+        bool load_store;
+
+        bool operator==(Quirks const& other) const;
+    };
+
+    uint8_t *buffer {nullptr};
+    size_t capacity {0};
+    size_t used {0};
+
+    // Full blocks, and single instruction blocks used when a block does
+    // not fit in what is left of the cycle budget
+    Block blocks[4096] {};
+    Block singles[4096] {};
+
+    Quirks quirks {};
+
+    Block const *lookup(CHIP8 &chip8, uint64_t const budget);
+    Block compile(CHIP8 &chip8, uint16_t const start, size_t const max_length);
+
+    static void call_exec(CHIP8 *chip8, uint64_t const packed);
+};
@@ -1,61 +1,157 @@
 #include "chip8.h"
 #include "graphics.h"
+#include "movie.h"
 #include "opcode_tester.h"
-#include "colors.h"
+#include "options.h"
+#include "pacer.h"
+#include "rewind.h"
 #include <GL/freeglut_std.h>
+#include <atomic>
 #include <chrono>
 #include <cmath>
 #include <cstring>
+#include <iostream>
 #include <algorithm>
+#include <thread>
 
 CHIP8 chip8{};;
+Rewind history{};
+
+// Written when the window closes, if a path was given
+Movie movie {};
+std::string movie_path {};
+
+// Held to play the last minute backwards
+unsigned char const REWIND_KEY {'\b'};
+std::atomic<bool> rewinding {false};
+
+// Run as fast as the host allows, still presenting at 60Hz
+bool turbo {false};
+// Single buffering draws straight to the screen, some old drivers need it
+bool double_buffered {true};
+
+std::atomic<bool> running {true};
+
+// How often the window looks for a new frame, twice per 60Hz frame
+unsigned const POLL_MS {8};
+
+// Key event timestamps, nanoseconds on the pacer clock
+uint64_t timestamp(FramePacer::Clock::time_point const time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               time.time_since_epoch()).count();
+}
+
+// Hands a key change to the emulation thread, dropped if it falls too far
+// behind to drain the queue
+void send_key(unsigned char const key, bool const pressed) {
+    auto const mapped {chip8.KEYMAP.find(key)};
+
+    if (mapped != chip8.KEYMAP.end()) {
+        chip8.key_events.push({timestamp(FramePacer::Clock::now()),
+                               static_cast<uint8_t>(mapped->second),
+                               pressed});
+    }
+}
 
 void on_press(unsigned const char key, int, int) {
-    if (chip8.KEYMAP.find(key) != chip8.KEYMAP.end()) {
-        uint16_t const current_key = chip8.KEYMAP.at(key);
-        // Set the corresponding bit for the key
-        chip8.keystates |= (0x001) << current_key;
+    if (key == REWIND_KEY) {
+        rewinding = true;
     }
+
+    send_key(key, true);
 }
 
 void on_release(unsigned const char key, int, int) {
-    if (chip8.KEYMAP.find(key) != chip8.KEYMAP.end()) {
-        uint16_t const current_key = chip8.KEYMAP.at(key);
-        // Set the corresponding bit for the key
-        chip8.keystates &= ~((0x001) << current_key);
+    if (key == REWIND_KEY) {
+        rewinding = false;
     }
+
+    send_key(key, false);
 }
 
-void loop(int) {
-    auto const start{std::chrono::high_resolution_clock::now()};
+// Emulates the frame due at the given time, or steps one frame back while
+// rewinding. Keys pressed after that time wait for a later frame.
+void advance(FramePacer::Clock::time_point const time) {
+    if (rewinding) {
+        CHIP8::State state {};
 
-    chip8.cycle();
+        if (history.step_back(state)) {
+            chip8.load_state(state);
+            movie.truncate(chip8.cycle_count());
+        }
+    } else {
+        uint64_t const cycle {chip8.cycle_count()};
+        chip8.run_frame(timestamp(time));
+        // Keys only change before the first instruction of a frame
+        movie.record(cycle, chip8.keystates);
+    }
+}
 
-    glutPostRedisplay();
+// The emulation thread, the machine publishes its frames to chip8.output
+void emulate() {
+    FramePacer pacer {};
 
-    auto const end{std::chrono::high_resolution_clock::now()};
+    while (running) {
+        int64_t const frames {pacer.due()};
 
-    double const elapsed =
-        std::chrono::duration_cast<std::chrono::milliseconds>(end - start)
-        .count();
+        if (frames && turbo && !rewinding) {
+            // Emulate for the whole frame period
+            auto const deadline {
+                FramePacer::Clock::now() + FramePacer::Frames{1}};
 
-    glutTimerFunc(std::max((1000.0-elapsed) / CHIP8::REFRESH_RATE, 0.0), loop, 0);
+            while (FramePacer::Clock::now() < deadline) {
+                advance(FramePacer::Clock::now());
+            }
+        } else {
+            // Frames caught up on get the input of their own period
+            auto const now {FramePacer::Clock::now()};
+
+            for (int64_t i {0}; i < frames; i++) {
+                advance(now - std::chrono::duration_cast<
+                                  FramePacer::Clock::duration>(
+                                  FramePacer::Frames{frames - 1 - i}));
+            }
+        }
+
+        std::this_thread::sleep_for(pacer.until_next());
+    }
 }
 
-void draw() {
-    glClear(GL_COLOR_BUFFER_BIT);
-    glColor3f(Colors::FG.r, Colors::FG.g, Colors::FG.b);
+// Runs on the window thread, never waits for the emulation thread
+void poll(int) {
+    TripleBuffer<CHIP8::Frame> &output {chip8.output};
+
+    // Only changed frames are published, so nothing new means nothing to
+    // upload or swap
+    if (output.acquire()) {
+        uint8_t pixels[CHIP8::DISPLAY_WIDTH * CHIP8::DISPLAY_HEIGHT];
+        CHIP8::Frame const& frame {output.front()};
 
-    for (int y = 0; y < chip8.DISPLAY_HEIGHT; y++) {
-        for (int x = 0; x < chip8.DISPLAY_WIDTH; x++) {
-            if (chip8.display[y][x]) {
-                graphics::draw_square(x, chip8.DISPLAY_HEIGHT - y - 1);
+        for (int y = 0; y < chip8.DISPLAY_HEIGHT; y++) {
+            for (int x = 0; x < chip8.DISPLAY_WIDTH; x++) {
+                pixels[y * CHIP8::DISPLAY_WIDTH + x] = frame.pixel(x, y);
             }
         }
+
+        graphics::upload(pixels);
+        glutPostRedisplay();
     }
 
-    glutSwapBuffers();
-    glFlush();
+    glutTimerFunc(POLL_MS, poll, 0);
+}
+
+// Also called when the window needs repainting, which reuses the texture
+void draw() {
+    graphics::present();
+}
+
+void usage(char const *name) {
+    std::cerr << "Usage: " << name
+              << " <rom> [--ips N] [--turbo] [--seed N] [--record MOVIE]\n"
+              << "       [--single-buffer] [--engine E] [--quirks Q]\n"
+              << "       " << name << " --opcode-test\n"
+              << "Engines: " << ENGINE_NAMES << "\n"
+              << "Quirks: " << QUIRKS_NAMES << std::endl;
 }
 
 int main(int argc, char **argv) {
@@ -68,8 +164,64 @@ int main(int argc, char **argv) {
         OPCodeTester tester {};
         tester.run(chip8);
     } else {
-        chip8.run_rom(argv[1]);
-        graphics::init(loop, draw, on_press, on_release, argc, argv);
+        // Unseeded runs still get a seed, so any of them can be recorded
+        uint64_t seed = std::chrono::steady_clock::now()
+                            .time_since_epoch().count();
+
+        for (int i {2}; i < argc; i++) {
+            std::string const arg {argv[i]};
+
+            if (arg == "--ips" && i + 1 < argc &&
+                parse_number(argv[i + 1], chip8.ips)) {
+                chip8.ips = std::max(1, chip8.ips);
+                i++;
+            } else if (arg == "--turbo") {
+                turbo = true;
+            } else if (arg == "--seed" && i + 1 < argc &&
+                       parse_number(argv[i + 1], seed)) {
+                i++;
+            } else if (arg == "--record" && i + 1 < argc) {
+                movie_path = argv[++i];
+            } else if (arg == "--single-buffer") {
+                double_buffered = false;
+            } else if (arg == "--engine" && i + 1 < argc &&
+                       parse_engine(argv[i + 1], chip8.engine)) {
+                i++;
+            } else if (arg == "--quirks" && i + 1 < argc &&
+                       parse_quirks(argv[i + 1], chip8.quirks)) {
+                i++;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+
+        // Rather than an empty window, and a movie of it
+        if (!chip8.run_rom(argv[1])) {
+            return 1;
+        }
+
+        movie.start(chip8, seed);
+        chip8.on_frame = [](CHIP8 &machine) {
+            CHIP8::State state {};
+            machine.save_state(state);
+            history.push(state);
+        };
+        std::thread emulation {emulate};
+        graphics::init(poll, draw, on_press, on_release, argc, argv,
+                       double_buffered);
+
+        running = false;
+        emulation.join();
+
+        if (!movie_path.empty()) {
+            movie.finish(chip8);
+
+            if (!movie.save(movie_path)) {
+                std::cerr << "Could not write movie " << movie_path
+                          << std::endl;
+            }
+        }
     }
 
     return 0;
@@ -0,0 +1,297 @@
+#include "movie.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace {
+
+uint8_t constexpr MOVIE_MAGIC[4] {'C', '8', 'M', 'V'};
+uint16_t constexpr MOVIE_VERSION {1};
+
+// Quirk flags, one bit each
+uint8_t constexpr LEGACY_JUMP {0x1};
+uint8_t constexpr LEGACY_SHIFT {0x2};
+uint8_t constexpr LEGACY_INDEX_ADD {0x4};
+uint8_t constexpr LEGACY_LOAD_STORE {0x8};
+
+struct Writer {
+    std::vector<uint8_t> &out;
+
+    void u8(uint8_t const v) {
+        out.push_back(v);
+    }
+
+    void u16(uint16_t const v) {
+        u8(v & 0xFF);
+        u8(v >> 8);
+    }
+
+    void u32(uint32_t const v) {
+        u16(v & 0xFFFF);
+        u16(v >> 16);
+    }
+
+    void u64(uint64_t const v) {
+        u32(v & 0xFFFFFFFF);
+        u32(v >> 32);
+    }
+
+    // Seven bits per byte, the high bit marks that more follow
+    void varint(uint64_t v) {
+        while (v >= 0x80) {
+            u8(static_cast<uint8_t>(v | 0x80));
+            v >>= 7;
+        }
+
+        u8(static_cast<uint8_t>(v));
+    }
+};
+
+// Reads past the end fail the reader instead of the caller
+struct Reader {
+    std::vector<uint8_t> const& in;
+    size_t pos {0};
+    bool ok {true};
+
+    uint8_t u8() {
+        if (pos >= in.size()) {
+            ok = false;
+            return 0;
+        }
+
+        return in[pos++];
+    }
+
+    uint16_t u16() {
+        uint16_t const lo {u8()};
+        return static_cast<uint16_t>(lo | u8() << 8);
+    }
+
+    uint32_t u32() {
+        uint32_t const lo {u16()};
+        return lo | static_cast<uint32_t>(u16()) << 16;
+    }
+
+    uint64_t u64() {
+        uint64_t const lo {u32()};
+        return lo | static_cast<uint64_t>(u32()) << 32;
+    }
+
+    uint64_t varint() {
+        uint64_t v {0};
+
+        for (int shift {0}; shift < 64; shift += 7) {
+            uint8_t const byte {u8()};
+            v |= static_cast<uint64_t>(byte & 0x7F) << shift;
+
+            if (!(byte & 0x80)) {
+                return v;
+            }
+        }
+
+        ok = false;
+        return v;
+    }
+};
+
+} // namespace
+
+void Movie::start(CHIP8 &chip8, uint64_t const seed) {
+    chip8.seed(seed);
+
+    this->seed = seed;
+    random = chip8.random;
+    ips = chip8.ips;
+    legacy_jump = chip8.USE_LEGACY_JUMP;
+    legacy_shift = chip8.USE_LEGACY_SHIFT;
+    legacy_index_add = chip8.USE_LEGACY_INDEX_ADD;
+    legacy_load_store = chip8.USE_LEGACY_LOAD_STORE;
+    rom_hash = hash_rom(chip8);
+    inputs.clear();
+
+    record(chip8.cycle_count(), chip8.keystates);
+}
+
+void Movie::record(uint64_t const cycle, uint16_t const keys) {
+    uint16_t const current {inputs.empty() ? uint16_t{0} : inputs.back().keys};
+
+    if (keys == current) {
+        return;
+    }
+
+    // A later change in the same cycle replaces the earlier one
+    if (!inputs.empty() && inputs.back().cycle == cycle) {
+        inputs.pop_back();
+
+        if (keys == (inputs.empty() ? 0 : inputs.back().keys)) {
+            return;
+        }
+    }
+
+    inputs.push_back({cycle, keys});
+}
+
+void Movie::truncate(uint64_t const cycle) {
+    inputs.erase(std::lower_bound(inputs.begin(), inputs.end(), cycle,
+                                  [](Input const& input, uint64_t const c) {
+                                      return input.cycle < c;
+                                  }),
+                 inputs.end());
+}
+
+void Movie::finish(CHIP8 const& chip8) {
+    cycles = chip8.cycle_count();
+    frames = chip8.frame_count();
+    frame_hash = chip8.frame_hash();
+}
+
+bool Movie::setup(CHIP8 &chip8) const {
+    if (hash_rom(chip8) != rom_hash) {
+        return false;
+    }
+
+    chip8.seed(seed);
+    chip8.random = random;
+    chip8.ips = ips;
+    chip8.USE_LEGACY_JUMP = legacy_jump;
+    chip8.USE_LEGACY_SHIFT = legacy_shift;
+    chip8.USE_LEGACY_INDEX_ADD = legacy_index_add;
+    chip8.USE_LEGACY_LOAD_STORE = legacy_load_store;
+    // The recorded flags decide, whatever profile the machine was set to
+    chip8.quirks = CHIP8::Quirks::RUNTIME;
+    chip8.select_quirks();
+    chip8.keystates = 0;
+    return true;
+}
+
+bool Movie::replay(CHIP8 &chip8) const {
+    for (Input const& input : inputs) {
+        if (input.cycle > chip8.cycle_count()) {
+            chip8.run(input.cycle - chip8.cycle_count());
+        }
+
+        chip8.keystates = input.keys;
+    }
+
+    if (cycles > chip8.cycle_count()) {
+        chip8.run(cycles - chip8.cycle_count());
+    }
+
+    return chip8.cycle_count() == cycles && chip8.frame_count() == frames &&
+           chip8.frame_hash() == frame_hash;
+}
+
+std::vector<uint8_t> Movie::encode() const {
+    std::vector<uint8_t> data;
+    Writer w {data};
+
+    for (uint8_t const c : MOVIE_MAGIC) {
+        w.u8(c);
+    }
+
+    w.u16(MOVIE_VERSION);
+    w.u64(seed);
+    w.u8(static_cast<uint8_t>(random));
+    w.u32(static_cast<uint32_t>(ips));
+    w.u8((legacy_jump ? LEGACY_JUMP : 0) | (legacy_shift ? LEGACY_SHIFT : 0) |
+         (legacy_index_add ? LEGACY_INDEX_ADD : 0) |
+         (legacy_load_store ? LEGACY_LOAD_STORE : 0));
+    w.u64(rom_hash);
+    w.u64(cycles);
+    w.u64(frames);
+    w.u64(frame_hash);
+    w.varint(inputs.size());
+
+    uint64_t previous {0};
+
+    for (Input const& input : inputs) {
+        w.varint(input.cycle - previous);
+        w.u16(input.keys);
+        previous = input.cycle;
+    }
+
+    return data;
+}
+
+bool Movie::decode(std::vector<uint8_t> const& data) {
+    if (data.size() < sizeof(MOVIE_MAGIC) ||
+        std::memcmp(data.data(), MOVIE_MAGIC, sizeof(MOVIE_MAGIC)) != 0) {
+        return false;
+    }
+
+    Reader r {data, sizeof(MOVIE_MAGIC)};
+
+    if (r.u16() != MOVIE_VERSION) {
+        return false;
+    }
+
+    Movie movie {};
+    movie.seed = r.u64();
+    movie.random = r.u8() ? CHIP8::Random::VIP : CHIP8::Random::PCG;
+    movie.ips = std::max(1, static_cast<int>(r.u32()));
+
+    uint8_t const quirks {r.u8()};
+    movie.legacy_jump = quirks & LEGACY_JUMP;
+    movie.legacy_shift = quirks & LEGACY_SHIFT;
+    movie.legacy_index_add = quirks & LEGACY_INDEX_ADD;
+    movie.legacy_load_store = quirks & LEGACY_LOAD_STORE;
+
+    movie.rom_hash = r.u64();
+    movie.cycles = r.u64();
+    movie.frames = r.u64();
+    movie.frame_hash = r.u64();
+
+    uint64_t const count {r.varint()};
+    uint64_t cycle {0};
+
+    // Every input takes at least three bytes, so a bad count stops here
+    // instead of allocating
+    for (uint64_t i {0}; i < count && r.ok; i++) {
+        cycle += r.varint();
+        uint16_t const keys {r.u16()};
+        movie.inputs.push_back({cycle, keys});
+    }
+
+    if (!r.ok) {
+        return false;
+    }
+
+    *this = std::move(movie);
+    return true;
+}
+
+bool Movie::save(std::string const& path) const {
+    std::ofstream ofs(path, std::ios::binary);
+    std::vector<uint8_t> const data {encode()};
+
+    ofs.write(reinterpret_cast<char const *>(data.data()), data.size());
+    return static_cast<bool>(ofs);
+}
+
+bool Movie::load(std::string const& path) {
+    std::ifstream ifs(path, std::ios::binary);
+
+    if (!ifs.is_open()) {
+        return false;
+    }
+
+    std::vector<uint8_t> const data((std::istreambuf_iterator<char>(ifs)),
+                                    std::istreambuf_iterator<char>());
+    return decode(data);
+}
+
+uint64_t Movie::hash_rom(CHIP8 const& chip8) {
+    CHIP8::State state {};
+    chip8.save_state(state);
+
+    // FNV-1a over the program area
+    uint64_t hash {0xCBF29CE484222325};
+
+    for (size_t i {0x200}; i < sizeof(state.memory); i++) {
+        hash ^= state.memory[i];
+        hash *= 0x100000001B3;
+    }
+
+    return hash;
+}
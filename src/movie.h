@@ -0,0 +1,65 @@
+#include "chip8.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#pragma once
+
+// A recorded run that replays bit for bit: how the machine was set up, and
+// every change of the key states stamped with the cycle it took effect on.
+// Key states only change between instructions, so that is all the input
+// there is.
+//
+// Record by calling start() right after run_rom(), then record() with the
+// key states of every run. Replay on a machine fresh from run_rom().
+struct Movie {
+    struct Input {
+        uint64_t cycle;
+        uint16_t keys;
+    };
+
+    uint64_t seed {};
+    CHIP8::Random random {CHIP8::Random::PCG};
+    int ips {CHIP8::REFRESH_RATE};
+    bool legacy_jump {};
+    bool legacy_shift {};
+    bool legacy_index_add {};
+    bool legacy_load_store {};
+    // FNV-1a of the program, so a movie is not replayed on another ROM
+    uint64_t rom_hash {};
+
+    // Ordered by cycle, keys are up before the first one
+    std::vector<Input> inputs;
+
+    // Where recording stopped, and what was on screen there
+    uint64_t cycles {};
+    uint64_t frames {};
+    uint64_t frame_hash {};
+
+    // Seeds the machine and takes its settings
+    void start(CHIP8 &chip8, uint64_t const seed);
+    // The key states the machine runs with from the given cycle on. Stored
+    // only when they change.
+    void record(uint64_t const cycle, uint16_t const keys);
+    // Forgets input from the given cycle on, for when the machine went back
+    // in time
+    void truncate(uint64_t const cycle);
+    void finish(CHIP8 const& chip8);
+
+    // Seeds the machine and applies the settings. Returns false if the
+    // machine holds another ROM.
+    bool setup(CHIP8 &chip8) const;
+    // Runs a set up machine through the whole movie as fast as it goes.
+    // Returns false if it ends on another frame than the recording.
+    bool replay(CHIP8 &chip8) const;
+
+    // Compact little endian format, cycles are stored as varint deltas.
+    // decode returns false if the data is not a movie.
+    std::vector<uint8_t> encode() const;
+    bool decode(std::vector<uint8_t> const& data);
+
+    bool save(std::string const& path) const;
+    bool load(std::string const& path);
+
+    static uint64_t hash_rom(CHIP8 const& chip8);
+};
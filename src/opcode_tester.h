@@ -1,16 +1,26 @@
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
+#include "aot.h"
+#include "batch.h"
 #include "chip8.h"
+#include "movie.h"
+#include "rewind.h"
+#include "trace.h"
 
 #pragma once
 
 // Macro to simplify usage
 #define ASSERT(condition) op_assert((condition), #condition)
 
-#define SET(array, index, value) \
+#define SET(chip8, index, value) \
     do { \
-        (array)[(index)] = static_cast<uint8_t>(((value) >> 8) & 0xFF); \
-        (array)[(index) + 1] = static_cast<uint8_t>((value) & 0xFF); \
+        uint8_t const bytes[2] { \
+            static_cast<uint8_t>(((value) >> 8) & 0xFF), \
+            static_cast<uint8_t>((value) & 0xFF), \
+        }; \
+        (chip8).write_memory((index), bytes, 2); \
     } while (0)
 
 #define SETUP(op) \
@@ -73,18 +83,14 @@ struct OPCodeTester {
         {
             SETUP("Clear Screen (0x00E0)");
 
-            std::fill(
-                &chip8.display[0][0],
-                &chip8.display[0][0] + CHIP8::DISPLAY_WIDTH * CHIP8::DISPLAY_HEIGHT,
-                true
-            );
-            SET(chip8.memory, 0x200, 0x00E0);
-            chip8.pc = 0x200;
+            std::fill(std::begin(chip8.presented.rows), std::end(chip8.presented.rows), ~0ULL);
+            SET(chip8, 0x200, 0x00E0);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
 
             for (int y {0}; y < CHIP8::DISPLAY_HEIGHT; y++) {
                 for (int x {0}; x < CHIP8::DISPLAY_WIDTH; x++) {
-                    res &= ASSERT(chip8.display[y][x] == false);
+                    res &= ASSERT(chip8.pixel(x, y) == false);
                 }
             }
                 
@@ -94,11 +100,11 @@ struct OPCodeTester {
         {
             SETUP("Jump (0x1NNN)");
 
-            SET(chip8.memory, 0x200, 0x10FF);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x10FF);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
 
-            res &= ASSERT(chip8.pc == 0x00FF);
+            res &= ASSERT(chip8.state.pc == 0x00FF);
 
             END(res, os);
         }
@@ -106,12 +112,12 @@ struct OPCodeTester {
         {
             SETUP("Jump with Offset(0xB0NN)");
 
-            chip8.registers[0x0] = 2;
-            SET(chip8.memory, 0x200, 0xB400);
-            chip8.pc = 0x200;
+            chip8.state.registers[0x0] = 2;
+            SET(chip8, 0x200, 0xB400);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
 
-            res &= ASSERT(chip8.pc == 0x0402);
+            res &= ASSERT(chip8.state.pc == 0x0402);
 
             END(res, os);
         }
@@ -119,12 +125,12 @@ struct OPCodeTester {
         {
             SETUP("Call Subroutine (0x2NNN)");
 
-            SET(chip8.memory, 0x200, 0x20FF);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x20FF);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
 
-            res &= ASSERT(chip8.pc == 0x00FF);
-            res &= ASSERT(chip8.stack.top() == 0x0202);
+            res &= ASSERT(chip8.state.pc == 0x00FF);
+            res &= ASSERT(chip8.state.stack[(chip8.state.sp - 1) & 0xF] == 0x0202);
 
             END(res, os);
         }
@@ -132,10 +138,10 @@ struct OPCodeTester {
         {
             SETUP("Return From Subroutine (0x00EE)");
 
-            SET(chip8.memory, 0x00FF, 0x00EE);
+            SET(chip8, 0x00FF, 0x00EE);
             chip8.cycle(true);
 
-            res &= ASSERT(chip8.pc == 0x0202);
+            res &= ASSERT(chip8.state.pc == 0x0202);
 
             END(res, os);
         }
@@ -143,16 +149,16 @@ struct OPCodeTester {
         {
             SETUP("Skip If Equal (0x3XNN)");
 
-            SET(chip8.memory, 0x200, 0x3003);
-            chip8.registers[0] = 2;
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x3003);
+            chip8.state.registers[0] = 2;
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.pc == 0x202);
+            res &= ASSERT(chip8.state.pc == 0x202);
 
-            chip8.registers[0] = 3;
-            chip8.pc = 0x200;
+            chip8.state.registers[0] = 3;
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.pc == 0x204);
+            res &= ASSERT(chip8.state.pc == 0x204);
 
             END(res, os);
         }
@@ -160,16 +166,16 @@ struct OPCodeTester {
         {
             SETUP("Skip If Not Equal (0x4XNN)");
 
-            SET(chip8.memory, 0x200, 0x4003);
-            chip8.registers[0] = 3;
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x4003);
+            chip8.state.registers[0] = 3;
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.pc == 0x202);
+            res &= ASSERT(chip8.state.pc == 0x202);
 
-            chip8.registers[0] = 2;
-            chip8.pc = 0x200;
+            chip8.state.registers[0] = 2;
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.pc == 0x204);
+            res &= ASSERT(chip8.state.pc == 0x204);
 
             END(res, os);
         }
@@ -177,18 +183,18 @@ struct OPCodeTester {
         {
             SETUP("Skip If Registers Equal (0x5XY0)");
 
-            SET(chip8.memory, 0x200, 0x5010);
-            chip8.registers[0] = 1;
-            chip8.registers[1] = 2;
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x5010);
+            chip8.state.registers[0] = 1;
+            chip8.state.registers[1] = 2;
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.pc == 0x202);
+            res &= ASSERT(chip8.state.pc == 0x202);
 
-            chip8.registers[0] = 1;
-            chip8.registers[1] = 1;
-            chip8.pc = 0x200;
+            chip8.state.registers[0] = 1;
+            chip8.state.registers[1] = 1;
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.pc == 0x204);
+            res &= ASSERT(chip8.state.pc == 0x204);
 
             END(res, os);
         }
@@ -196,18 +202,18 @@ struct OPCodeTester {
         {
             SETUP("Skip If Registers Not Equal (0x9XY0)");
 
-            SET(chip8.memory, 0x200, 0x9010);
-            chip8.registers[0] = 1;
-            chip8.registers[1] = 1;
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x9010);
+            chip8.state.registers[0] = 1;
+            chip8.state.registers[1] = 1;
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.pc == 0x202);
+            res &= ASSERT(chip8.state.pc == 0x202);
 
-            chip8.registers[0] = 2;
-            chip8.registers[1] = 1;
-            chip8.pc = 0x200;
+            chip8.state.registers[0] = 2;
+            chip8.state.registers[1] = 1;
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.pc == 0x204);
+            res &= ASSERT(chip8.state.pc == 0x204);
 
             END(res, os);
         }
@@ -215,10 +221,10 @@ struct OPCodeTester {
         {
             SETUP("Set (0x6XNN)");
 
-            SET(chip8.memory, 0x200, 0x6303);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x6303);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.registers[3] == 0x03);
+            res &= ASSERT(chip8.state.registers[3] == 0x03);
 
             END(res, os);
         }
@@ -226,10 +232,10 @@ struct OPCodeTester {
         {
             SETUP("Add (0x7XNN)");
 
-            SET(chip8.memory, 0x200, 0x7302);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x7302);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.registers[3] == 0x05);
+            res &= ASSERT(chip8.state.registers[3] == 0x05);
 
             END(res, os);
         }
@@ -237,39 +243,144 @@ struct OPCodeTester {
         {
             SETUP("Set Index (0xANNN)");
 
-            SET(chip8.memory, 0x200, 0xA0BC);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0xA0BC);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.I == 0xBC);
+            res &= ASSERT(chip8.state.I == 0xBC);
 
             END(res, os);
         }
 
-        // TODO: test draw
+        {
+            SETUP("Draw (0xDXYN)");
+
+            // Pixel in the buffer that draw writes to
+            auto const lit = [&chip8](int const x, int const y) {
+                return ((chip8.state.display_buffer[y] >> (63 - x)) & 0x1) != 0;
+            };
+
+            std::fill(std::begin(chip8.state.display_buffer), std::end(chip8.state.display_buffer), 0);
+
+            // The "0" glyph, 0xF0 0x90 0x90 0x90 0xF0, in the bottom right
+            chip8.state.I = 0x50;
+            chip8.state.registers[0] = 62;
+            chip8.state.registers[1] = 30;
+            SET(chip8, 0x200, 0xD015);
+            chip8.state.pc = 0x200;
+            chip8.cycle(true);
+
+            // Only the top left corner fits, nothing wraps around
+            res &= ASSERT(lit(62, 30) && lit(63, 30));
+            res &= ASSERT(lit(62, 31) && !lit(63, 31));
+            res &= ASSERT(!lit(0, 30) && !lit(62, 0));
+            res &= ASSERT(chip8.state.registers[0xF] == 0);
+
+            // Drawing it again erases it and reports the collision
+            chip8.state.pc = 0x200;
+            chip8.cycle(true);
+            res &= ASSERT(!lit(62, 30) && !lit(62, 31));
+            res &= ASSERT(chip8.state.registers[0xF] == 1);
+
+            END(res, os);
+        }
 
         {
             SETUP("Random (0xCX0F)");
 
-            SET(chip8.memory, 0x200, 0xC00F);
-            chip8.registers[0] = 0xFF;
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0xC00F);
+            chip8.state.registers[0] = 0xFF;
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
             // Make sure the mask work
-            res &= ASSERT(!(chip8.registers[0] & 0xF0));
+            res &= ASSERT(!(chip8.state.registers[0] & 0xF0));
 
             END(res, os);
         }
 
+        {
+            SETUP("Seeded Random (0xCXFF)");
+
+            // Seeds only apply to PCG
+            CHIP8::Random const random {chip8.random};
+            chip8.random = CHIP8::Random::PCG;
+            SET(chip8, 0x200, 0xC0FF);
+            uint8_t first[8];
+
+            // The same seed gives the same numbers
+            for (int run {0}; run < 2; run++) {
+                chip8.seed(1234);
+
+                for (uint8_t &value : first) {
+                    chip8.state.pc = 0x200;
+                    chip8.cycle(true);
+
+                    if (run == 0) {
+                        value = chip8.state.registers[0];
+                    } else {
+                        res &= ASSERT(value == chip8.state.registers[0]);
+                    }
+                }
+            }
+
+            auto const draw = [&chip8] {
+                chip8.state.pc = 0x200;
+                chip8.cycle(true);
+                return chip8.state.registers[0];
+            };
+
+            // Not a constant
+            res &= ASSERT(std::any_of(std::begin(first), std::end(first),
+                                      [&](uint8_t const value) {
+                                          return value != first[0];
+                                      }));
+
+            // Another seed, other numbers
+            chip8.seed(4321);
+            bool differs {false};
+
+            for (uint8_t const value : first) {
+                differs |= draw() != value;
+            }
+
+            res &= ASSERT(differs);
+
+            // A snapshot carries the generator, restoring it repeats the
+            // rest of the sequence
+            chip8.seed(1234);
+
+            for (int i {0}; i < 4; i++) {
+                draw();
+            }
+
+            CHIP8::State snapshot {};
+            chip8.save_state(snapshot);
+            uint8_t rest[4];
+
+            for (int i {0}; i < 4; i++) {
+                rest[i] = draw();
+                res &= ASSERT(rest[i] == first[4 + i]);
+            }
+
+            chip8.load_state(snapshot);
+
+            for (int i {0}; i < 4; i++) {
+                res &= ASSERT(draw() == rest[i]);
+            }
+
+            chip8.random = random;
+            END(res, os);
+        }
+
         {
             SETUP("Set Register (0x8XY0)");
 
-            chip8.registers[0] = 0x3;
-            chip8.registers[1] = 0x4;
+            chip8.state.registers[0] = 0x3;
+            chip8.state.registers[1] = 0x4;
 
-            SET(chip8.memory, 0x200, 0x8010);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x8010);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.registers[0] == 0x4);
+            res &= ASSERT(chip8.state.registers[0] == 0x4);
 
             END(res, os);
         }
@@ -277,13 +388,13 @@ struct OPCodeTester {
         {
             SETUP("Binary OR (0x8XY1)");
 
-            chip8.registers[0] = 0x3;
-            chip8.registers[1] = 0x4;
+            chip8.state.registers[0] = 0x3;
+            chip8.state.registers[1] = 0x4;
 
-            SET(chip8.memory, 0x200, 0x8011);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x8011);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.registers[0] == 0x7);
+            res &= ASSERT(chip8.state.registers[0] == 0x7);
 
             END(res, os);
         }
@@ -291,13 +402,13 @@ struct OPCodeTester {
         {
             SETUP("Binary AND (0x8XY2)");
 
-            chip8.registers[0] = 0x3;
-            chip8.registers[1] = 0x4;
+            chip8.state.registers[0] = 0x3;
+            chip8.state.registers[1] = 0x4;
 
-            SET(chip8.memory, 0x200, 0x8012);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x8012);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.registers[0] == 0x0);
+            res &= ASSERT(chip8.state.registers[0] == 0x0);
 
             END(res, os);
         }
@@ -305,13 +416,13 @@ struct OPCodeTester {
         {
             SETUP("Logical XOR (0x8XY3)");
 
-            chip8.registers[0] = 0x3;
-            chip8.registers[1] = 0x4;
+            chip8.state.registers[0] = 0x3;
+            chip8.state.registers[1] = 0x4;
 
-            SET(chip8.memory, 0x200, 0x8013);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x8013);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.registers[0] == 0x7);
+            res &= ASSERT(chip8.state.registers[0] == 0x7);
 
             END(res, os);
         }
@@ -319,23 +430,23 @@ struct OPCodeTester {
         {
             SETUP("Add Registers (0x8XY4)");
 
-            chip8.registers[0] = 0x3;
-            chip8.registers[1] = 0x4;
+            chip8.state.registers[0] = 0x3;
+            chip8.state.registers[1] = 0x4;
 
-            SET(chip8.memory, 0x200, 0x8014);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x8014);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.registers[0] == 0x7);
+            res &= ASSERT(chip8.state.registers[0] == 0x7);
 
             // Test overflow
-            chip8.registers[0] = 0xFF;
-            chip8.registers[1] = 0x01;
+            chip8.state.registers[0] = 0xFF;
+            chip8.state.registers[1] = 0x01;
 
-            SET(chip8.memory, 0x200, 0x8014);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x8014);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.registers[0] == 0x0);
-            res &= ASSERT(chip8.registers[0xF] == 0x1);
+            res &= ASSERT(chip8.state.registers[0] == 0x0);
+            res &= ASSERT(chip8.state.registers[0xF] == 0x1);
 
             END(res, os);
         }
@@ -343,23 +454,23 @@ struct OPCodeTester {
         {
             SETUP("Subtract X-Y (0x8XY5)");
 
-            chip8.registers[0] = 0x4;
-            chip8.registers[1] = 0x3;
+            chip8.state.registers[0] = 0x4;
+            chip8.state.registers[1] = 0x3;
 
-            SET(chip8.memory, 0x200, 0x8015);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x8015);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.registers[0] == 0x1);
+            res &= ASSERT(chip8.state.registers[0] == 0x1);
 
             // Test underflow
-            chip8.registers[0] = 0x03;
-            chip8.registers[1] = 0x04;
+            chip8.state.registers[0] = 0x03;
+            chip8.state.registers[1] = 0x04;
 
-            SET(chip8.memory, 0x200, 0x8015);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x8015);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.registers[0] == 0xFF);
-            res &= ASSERT(chip8.registers[0xF] == 0x1);
+            res &= ASSERT(chip8.state.registers[0] == 0xFF);
+            res &= ASSERT(chip8.state.registers[0xF] == 0x1);
 
             END(res, os);
         }
@@ -367,23 +478,23 @@ struct OPCodeTester {
         {
             SETUP("Subtract Y-X (0x8XY7)");
 
-            chip8.registers[0] = 0x3;
-            chip8.registers[1] = 0x4;
+            chip8.state.registers[0] = 0x3;
+            chip8.state.registers[1] = 0x4;
 
-            SET(chip8.memory, 0x200, 0x8017);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x8017);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.registers[0] == 0x1);
+            res &= ASSERT(chip8.state.registers[0] == 0x1);
 
             // Test underflow
-            chip8.registers[0] = 0x04;
-            chip8.registers[1] = 0x03;
+            chip8.state.registers[0] = 0x04;
+            chip8.state.registers[1] = 0x03;
 
-            SET(chip8.memory, 0x200, 0x8017);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x8017);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.registers[0] == 0xFF);
-            res &= ASSERT(chip8.registers[0xF] == 0x1);
+            res &= ASSERT(chip8.state.registers[0] == 0xFF);
+            res &= ASSERT(chip8.state.registers[0xF] == 0x1);
 
             END(res, os);
         }
@@ -392,22 +503,22 @@ struct OPCodeTester {
             SETUP("Shift Right (0x8XY6)");
 
             chip8.USE_LEGACY_SHIFT = false;
-            chip8.registers[0] = 0x5;
+            chip8.state.registers[0] = 0x5;
 
-            SET(chip8.memory, 0x200, 0x8016);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x8016);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.registers[0] == 0x2);
-            res &= ASSERT(chip8.registers[0xF] == 0x1);
+            res &= ASSERT(chip8.state.registers[0] == 0x2);
+            res &= ASSERT(chip8.state.registers[0xF] == 0x1);
 
             chip8.USE_LEGACY_SHIFT = true;
-            chip8.registers[1] = 0x5;
+            chip8.state.registers[1] = 0x5;
 
-            SET(chip8.memory, 0x200, 0x8016);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x8016);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.registers[0] == 0x2);
-            res &= ASSERT(chip8.registers[0xF] == 0x1);
+            res &= ASSERT(chip8.state.registers[0] == 0x2);
+            res &= ASSERT(chip8.state.registers[0xF] == 0x1);
 
             END(res, os);
         }
@@ -416,22 +527,22 @@ struct OPCodeTester {
             SETUP("Shift Left (0x8XYE)");
 
             chip8.USE_LEGACY_SHIFT = false;
-            chip8.registers[0] = 0x8C;
+            chip8.state.registers[0] = 0x8C;
 
-            SET(chip8.memory, 0x200, 0x801E);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x801E);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.registers[0] == 0x18);
-            res &= ASSERT(chip8.registers[0xF] == 0x1);
+            res &= ASSERT(chip8.state.registers[0] == 0x18);
+            res &= ASSERT(chip8.state.registers[0xF] == 0x1);
 
             chip8.USE_LEGACY_SHIFT = true;
-            chip8.registers[1] = 0x2;
+            chip8.state.registers[1] = 0x2;
 
-            SET(chip8.memory, 0x200, 0x801E);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0x801E);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
-            res &= ASSERT(chip8.registers[0] == 0x4);
-            res &= ASSERT(chip8.registers[0xF] == 0x0);
+            res &= ASSERT(chip8.state.registers[0] == 0x4);
+            res &= ASSERT(chip8.state.registers[0xF] == 0x0);
 
             END(res, os);
         }
@@ -440,19 +551,19 @@ struct OPCodeTester {
             SETUP("Skip If Key (0xEX9E)");
 
             chip8.keystates = 0;
-            chip8.registers[0] = 0xA;
+            chip8.state.registers[0] = 0xA;
 
-            SET(chip8.memory, 0x200, 0xE09E);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0xE09E);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
 
-            res &= ASSERT(chip8.pc == 0x202);
+            res &= ASSERT(chip8.state.pc == 0x202);
 
             chip8.keystates = (0x1 << 0xA);
-            chip8.pc = 0x200;
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
 
-            res &= ASSERT(chip8.pc == 0x204);
+            res &= ASSERT(chip8.state.pc == 0x204);
 
             END(res, os);
         }
@@ -461,19 +572,19 @@ struct OPCodeTester {
             SETUP("Skip If Not Key (0xEXA1)");
 
             chip8.keystates = 0;
-            chip8.registers[0] = 0xA;
+            chip8.state.registers[0] = 0xA;
 
-            SET(chip8.memory, 0x200, 0xE0A1);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0xE0A1);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
 
-            res &= ASSERT(chip8.pc == 0x204);
+            res &= ASSERT(chip8.state.pc == 0x204);
 
             chip8.keystates = (0x1 << 0xA);
-            chip8.pc = 0x200;
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
 
-            res &= ASSERT(chip8.pc == 0x202);
+            res &= ASSERT(chip8.state.pc == 0x202);
 
             END(res, os);
         }
@@ -481,12 +592,12 @@ struct OPCodeTester {
         {
             SETUP("Set X to Delay Timer (0xFX07)");
 
-            SET(chip8.memory, 0x200, 0xF007);
-            chip8.delay_timer = 60;
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0xF007);
+            chip8.state.delay_timer = 60;
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
 
-            res &= ASSERT(chip8.registers[0] == 60);
+            res &= ASSERT(chip8.state.registers[0] == 60);
 
             END(res, os);
         }
@@ -494,13 +605,13 @@ struct OPCodeTester {
         {
             SETUP("Set Delay Timer to X (0xFX15)");
 
-            chip8.delay_timer = 0;
-            chip8.registers[0] = 60;
-            SET(chip8.memory, 0x200, 0xF015);
-            chip8.pc = 0x200;
+            chip8.state.delay_timer = 0;
+            chip8.state.registers[0] = 60;
+            SET(chip8, 0x200, 0xF015);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
 
-            res &= ASSERT(chip8.delay_timer == 60);
+            res &= ASSERT(chip8.state.delay_timer == 60);
 
             END(res, os);
         }
@@ -508,13 +619,13 @@ struct OPCodeTester {
         {
             SETUP("Set Sound Timer to X (0xFX18)");
 
-            chip8.sound_timer = 0;
-            chip8.registers[0] = 60;
-            SET(chip8.memory, 0x200, 0xF018);
-            chip8.pc = 0x200;
+            chip8.state.sound_timer = 0;
+            chip8.state.registers[0] = 60;
+            SET(chip8, 0x200, 0xF018);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
 
-            res &= ASSERT(chip8.sound_timer == 60);
+            res &= ASSERT(chip8.state.sound_timer == 60);
 
             END(res, os);
         }
@@ -523,23 +634,23 @@ struct OPCodeTester {
             SETUP("Add X to Index (0xF01E)");
 
             chip8.USE_LEGACY_INDEX_ADD = false;
-            chip8.registers[0] = 1;
-            chip8.I = 0xFFFF;
-            SET(chip8.memory, 0x200, 0xF01E);
-            chip8.pc = 0x200;
+            chip8.state.registers[0] = 1;
+            chip8.state.I = 0xFFFF;
+            SET(chip8, 0x200, 0xF01E);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
 
-            res &= ASSERT(chip8.I == 0);
+            res &= ASSERT(chip8.state.I == 0);
 
             chip8.USE_LEGACY_INDEX_ADD = true;
-            chip8.registers[0] = 1;
-            chip8.I = 0xFFFF;
-            SET(chip8.memory, 0x200, 0xF01E);
-            chip8.pc = 0x200;
+            chip8.state.registers[0] = 1;
+            chip8.state.I = 0xFFFF;
+            SET(chip8, 0x200, 0xF01E);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
 
-            res &= ASSERT(chip8.I == 0);
-            res &= ASSERT(chip8.registers[0xF] == 1);
+            res &= ASSERT(chip8.state.I == 0);
+            res &= ASSERT(chip8.state.registers[0xF] == 1);
 
             END(res, os);
         }
@@ -548,15 +659,15 @@ struct OPCodeTester {
             SETUP("Get Key (0xFX0A)");
 
             chip8.keystates = 0;
-            SET(chip8.memory, 0x200, 0xF00A);
-            chip8.pc = 0x200;
+            SET(chip8, 0x200, 0xF00A);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
 
-            res &= ASSERT(chip8.pc == 0x200);
+            res &= ASSERT(chip8.state.pc == 0x200);
              
             chip8.keystates = (0x1 << 0xA);
             chip8.cycle(true);
-            res &= ASSERT(chip8.pc == 0x202);
+            res &= ASSERT(chip8.state.pc == 0x202);
 
             END(res, os);
         }
@@ -564,12 +675,12 @@ struct OPCodeTester {
         {
             SETUP("Font Character (0xFX29)");
 
-            chip8.registers[0] = 0xA;
-            SET(chip8.memory, 0x200, 0xF029);
-            chip8.pc = 0x200;
+            chip8.state.registers[0] = 0xA;
+            SET(chip8, 0x200, 0xF029);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
 
-            res &= ASSERT(chip8.I == 0x0082);
+            res &= ASSERT(chip8.state.I == 0x0082);
 
             END(res, os);
         }
@@ -577,15 +688,15 @@ struct OPCodeTester {
         {
             SETUP("Binary Coded Decimal Conversion (0xFX033)");
 
-            chip8.registers[0] = 0x9C;
-            chip8.I = 0x00FF;
-            SET(chip8.memory, 0x200, 0xF033);
-            chip8.pc = 0x200;
+            chip8.state.registers[0] = 0x9C;
+            chip8.state.I = 0x00FF;
+            SET(chip8, 0x200, 0xF033);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
 
-            res &= ASSERT(chip8.memory[chip8.I] == 1);
-            res &= ASSERT(chip8.memory[chip8.I+1] == 5);
-            res &= ASSERT(chip8.memory[chip8.I+2] == 6);
+            res &= ASSERT(chip8.state.memory[chip8.state.I] == 1);
+            res &= ASSERT(chip8.state.memory[chip8.state.I+1] == 5);
+            res &= ASSERT(chip8.state.memory[chip8.state.I+2] == 6);
 
             END(res, os);
         }
@@ -594,28 +705,28 @@ struct OPCodeTester {
             SETUP("Store (0xFX55)");
 
             chip8.USE_LEGACY_LOAD_STORE = false;
-            chip8.registers[0] = 0x0;
-            chip8.registers[1] = 0x2;
-            chip8.registers[2] = 0x5;
-
-            chip8.I = 0x0400;
-            chip8.registers[0xA] = 0x2;
-            SET(chip8.memory, 0x200, 0xFA55);
-            chip8.pc = 0x200;
+            chip8.state.registers[0] = 0x0;
+            chip8.state.registers[1] = 0x2;
+            chip8.state.registers[2] = 0x5;
+
+            chip8.state.I = 0x0400;
+            chip8.state.registers[0xA] = 0x2;
+            SET(chip8, 0x200, 0xFA55);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
 
-            res &= ASSERT(chip8.memory[chip8.I] == 0x0);
-            res &= ASSERT(chip8.memory[chip8.I+1] == 0x2);
-            res &= ASSERT(chip8.memory[chip8.I+2] == 0x5);
+            res &= ASSERT(chip8.state.memory[chip8.state.I] == 0x0);
+            res &= ASSERT(chip8.state.memory[chip8.state.I+1] == 0x2);
+            res &= ASSERT(chip8.state.memory[chip8.state.I+2] == 0x5);
 
             chip8.USE_LEGACY_LOAD_STORE = true;
-            chip8.pc = 0x200;
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
 
-            res &= ASSERT(chip8.memory[0x400] == 0x0);
-            res &= ASSERT(chip8.memory[0x401] == 0x2);
-            res &= ASSERT(chip8.memory[0x402] == 0x5);
-            res &= ASSERT(chip8.I == 0x403);
+            res &= ASSERT(chip8.state.memory[0x400] == 0x0);
+            res &= ASSERT(chip8.state.memory[0x401] == 0x2);
+            res &= ASSERT(chip8.state.memory[0x402] == 0x5);
+            res &= ASSERT(chip8.state.I == 0x403);
 
             END(res, os);
         }
@@ -625,27 +736,578 @@ struct OPCodeTester {
 
             chip8.USE_LEGACY_LOAD_STORE = false;
 
-            chip8.I = 0x400;
-            chip8.registers[0xA] = 0x2;
-            SET(chip8.memory, 0x200, 0xFA65);
-            chip8.memory[0x400] = 0x3;
-            chip8.memory[0x401] = 0x7;
-            chip8.memory[0x402] = 0xA;
-            chip8.pc = 0x200;
+            chip8.state.I = 0x400;
+            chip8.state.registers[0xA] = 0x2;
+            SET(chip8, 0x200, 0xFA65);
+            chip8.state.memory[0x400] = 0x3;
+            chip8.state.memory[0x401] = 0x7;
+            chip8.state.memory[0x402] = 0xA;
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
 
-            res &= ASSERT(chip8.registers[0] == 0x3);
-            res &= ASSERT(chip8.registers[1] == 0x7);
-            res &= ASSERT(chip8.registers[2] == 0xA);
+            res &= ASSERT(chip8.state.registers[0] == 0x3);
+            res &= ASSERT(chip8.state.registers[1] == 0x7);
+            res &= ASSERT(chip8.state.registers[2] == 0xA);
 
             chip8.USE_LEGACY_LOAD_STORE = true;
-            chip8.pc = 0x200;
+            chip8.state.pc = 0x200;
+            chip8.cycle(true);
+
+            res &= ASSERT(chip8.state.registers[0] == 0x3);
+            res &= ASSERT(chip8.state.registers[1] == 0x7);
+            res &= ASSERT(chip8.state.registers[2] == 0xA);
+            res &= ASSERT(chip8.state.I == 0x403);
+
+            END(res, os);
+        }
+
+        {
+            SETUP("Self-Modifying Store (0xFX55)");
+
+            // Execute once so the instruction is decoded and cached
+            SET(chip8, 0x202, 0x6005);
+            chip8.state.pc = 0x202;
+            chip8.cycle(true);
+            res &= ASSERT(chip8.state.registers[0] == 0x5);
+
+            // Overwrite it with 0x7003
+            chip8.state.registers[0] = 0x70;
+            chip8.state.registers[1] = 0x03;
+            chip8.state.I = 0x202;
+            SET(chip8, 0x200, 0xF155);
+            chip8.state.pc = 0x200;
             chip8.cycle(true);
 
-            res &= ASSERT(chip8.registers[0] == 0x3);
-            res &= ASSERT(chip8.registers[1] == 0x7);
-            res &= ASSERT(chip8.registers[2] == 0xA);
-            res &= ASSERT(chip8.I == 0x403);
+            chip8.state.registers[0] = 0x1;
+            chip8.state.pc = 0x202;
+            chip8.cycle(true);
+            res &= ASSERT(chip8.state.registers[0] == 0x4);
+
+            END(res, os);
+        }
+
+        {
+            SETUP("Memory Wrap (I = 0xFFE)");
+
+            // Stores and loads past 0xFFF wrap to 0x000, as in a batch lane
+            chip8.USE_LEGACY_LOAD_STORE = false;
+            chip8.state.I = 0xFFE;
+
+            for (uint8_t i {0}; i < 4; i++) {
+                chip8.state.registers[i] = i + 1;
+            }
+
+            SET(chip8, 0x200, 0xF355);
+            SET(chip8, 0x202, 0xF365);
+            chip8.state.pc = 0x200;
+
+            CHIP8Batch batch {chip8, 1};
+            batch.run(1);
+            chip8.cycle(true);
+
+            res &= ASSERT(chip8.state.memory[0xFFE] == 1);
+            res &= ASSERT(chip8.state.memory[0xFFF] == 2);
+            res &= ASSERT(chip8.state.memory[0x000] == 3);
+            res &= ASSERT(chip8.state.memory[0x001] == 4);
+
+            CHIP8::State lane {};
+            batch.save_state(0, lane);
+            res &= ASSERT(std::equal(std::begin(lane.memory),
+                                     std::end(lane.memory),
+                                     std::begin(chip8.state.memory)));
+
+            for (uint8_t i {0}; i < 4; i++) {
+                chip8.state.registers[i] = 0;
+            }
+
+            chip8.cycle(true);
+            res &= ASSERT(chip8.state.registers[2] == 3);
+            res &= ASSERT(chip8.state.registers[3] == 4);
+
+            uint8_t const zeros[2] {};
+            chip8.write_memory(0x000, zeros, sizeof(zeros));
+
+            END(res, os);
+        }
+
+        {
+            SETUP("Save/Load State");
+
+            SET(chip8, 0x202, 0x7001);
+            chip8.state.registers[0] = 0x1;
+            chip8.state.pc = 0x202;
+            chip8.cycle(true);
+
+            CHIP8::State snapshot {};
+            chip8.save_state(snapshot);
+
+            // Change the registers and overwrite the cached instruction
+            chip8.state.registers[0] = 0x60;
+            chip8.state.registers[1] = 0x00;
+            chip8.state.I = 0x202;
+            SET(chip8, 0x200, 0xF155);
+            chip8.state.pc = 0x200;
+            chip8.cycle(true);
+
+            // Round trip through the binary format before restoring
+            uint8_t bytes[CHIP8::SERIALIZED_SIZE];
+            CHIP8::serialize(snapshot, bytes);
+            CHIP8::State restored {};
+            res &= ASSERT(CHIP8::deserialize(bytes, sizeof(bytes), restored));
+            chip8.load_state(restored);
+
+            res &= ASSERT(chip8.state.registers[0] == 0x2);
+            res &= ASSERT(chip8.state.pc == 0x204);
+
+            // The restored 0x7001 runs, not the stored 0x6000
+            chip8.state.pc = 0x202;
+            chip8.cycle(true);
+            res &= ASSERT(chip8.state.registers[0] == 0x3);
+
+            END(res, os);
+        }
+
+        {
+            SETUP("Run Frame");
+
+            // Jump to self
+            SET(chip8, 0x200, 0x1200);
+            chip8.state.pc = 0x200;
+            chip8.ips = 1000;
+            chip8.resume();
+            // Start on a frame boundary
+            chip8.run_frame();
+
+            uint64_t const frames {chip8.frame_count()};
+            uint64_t cycles {0};
+
+            for (int i {0}; i < 60; i++) {
+                cycles += chip8.run_frame();
+            }
+
+            chip8.pause();
+
+            // One second of emulated time, one frame per call
+            res &= ASSERT(chip8.frame_count() == frames + 60);
+            res &= ASSERT(cycles >= 999 && cycles <= 1001);
+            chip8.ips = CHIP8::REFRESH_RATE;
+
+            END(res, os);
+        }
+
+        {
+            SETUP("Display Generation");
+
+            // Draw the 0 glyph, then draw it twice more which erases and
+            // redraws it, jumping to self in between
+            SET(chip8, 0x200, 0xD015);
+            SET(chip8, 0x202, 0x1202);
+            SET(chip8, 0x204, 0xD015);
+            SET(chip8, 0x206, 0xD015);
+            SET(chip8, 0x208, 0x1208);
+            chip8.state.registers[0] = 0;
+            chip8.state.registers[1] = 0;
+            chip8.state.I = 0x50;
+            chip8.state.pc = 0x202;
+            chip8.resume();
+
+            // Start from a frame with no glyph on screen
+            std::fill(std::begin(chip8.state.display_buffer),
+                      std::end(chip8.state.display_buffer), 0);
+            chip8.dirty_rows = ~uint32_t{0};
+            chip8.run_frame();
+            chip8.state.pc = 0x200;
+
+            uint64_t const before {chip8.display_generation()};
+            chip8.output.acquire();
+            chip8.run_frame();
+            res &= ASSERT(chip8.display_generation() == before + 1);
+
+            // Changed frames are published
+            res &= ASSERT(chip8.output.acquire());
+            res &= ASSERT(chip8.output.front().pixel(0, 0));
+
+            chip8.run_frame();
+            res &= ASSERT(chip8.display_generation() == before + 1);
+            res &= ASSERT(!chip8.output.acquire());
+
+            // Erased and redrawn within one frame, nothing to present
+            chip8.state.pc = 0x204;
+            chip8.run_frame();
+            res &= ASSERT(chip8.display_generation() == before + 1);
+            res &= ASSERT(chip8.pixel(0, 0));
+
+            chip8.pause();
+
+            END(res, os);
+        }
+
+        {
+            SETUP("Key Events");
+
+            // Skip if key in V0 is pressed
+            SET(chip8, 0x200, 0xE09E);
+            chip8.state.registers[0] = 0xA;
+            chip8.keystates = 0;
+
+            // Pressed and released before the machine looks
+            chip8.key_events.push({1, 0xA, true});
+            chip8.key_events.push({2, 0xA, false});
+            // Not due yet
+            chip8.key_events.push({5, 0xB, true});
+
+            chip8.apply_input(4);
+            chip8.state.pc = 0x200;
+            chip8.cycle(true);
+            res &= ASSERT(chip8.state.pc == 0x204);
+            res &= ASSERT(!(chip8.keystates & (0x1 << 0xB)));
+
+            // The short press ends on the next drain
+            chip8.apply_input(4);
+            chip8.state.pc = 0x200;
+            chip8.cycle(true);
+            res &= ASSERT(chip8.state.pc == 0x202);
+
+            chip8.apply_input();
+            res &= ASSERT(chip8.keystates == (0x1 << 0xB));
+            chip8.keystates = 0;
+
+            END(res, os);
+        }
+
+        {
+            SETUP("Movie");
+
+            // Count in V1 while the key in V0 is held, V2 gets a random
+            SET(chip8, 0x200, 0xE09E);
+            SET(chip8, 0x202, 0x1200);
+            SET(chip8, 0x204, 0x7101);
+            SET(chip8, 0x206, 0xC2FF);
+            SET(chip8, 0x208, 0x1200);
+            chip8.state.pc = 0x200;
+            chip8.state.registers[0] = 0x5;
+            chip8.state.registers[1] = 0;
+            chip8.keystates = 0;
+
+            CHIP8 recorded {chip8};
+            CHIP8 replayed {chip8};
+            recorded.resume();
+            replayed.resume();
+
+            Movie movie {};
+            movie.start(recorded, 42);
+
+            for (uint16_t const keys : {0x0000, 0x0020, 0x0020, 0x0000}) {
+                recorded.keystates = keys;
+                movie.record(recorded.cycle_count(), keys);
+                recorded.run(37);
+            }
+
+            movie.finish(recorded);
+            res &= ASSERT(movie.inputs.size() == 2);
+
+            // Round trip through the file format
+            Movie loaded {};
+            res &= ASSERT(loaded.decode(movie.encode()));
+            res &= ASSERT(loaded.setup(replayed));
+            res &= ASSERT(loaded.replay(replayed));
+            res &= ASSERT(replayed.state.registers[1] ==
+                          recorded.state.registers[1]);
+            res &= ASSERT(replayed.state.registers[2] ==
+                          recorded.state.registers[2]);
+            res &= ASSERT(recorded.state.registers[1] != 0);
+
+            END(res, os);
+        }
+
+#ifdef CHIP8_PROFILE
+        {
+            SETUP("Profile");
+
+            // Wait for a key, then loop on a jump to self
+            SET(chip8, 0x200, 0xF00A);
+            SET(chip8, 0x202, 0x1202);
+            chip8.state.pc = 0x200;
+            chip8.keystates = 0;
+            chip8.profile.clear();
+
+            chip8.cycle(true);
+            chip8.cycle(true);
+            chip8.keystates = 0x1;
+            chip8.cycle(true);
+            chip8.cycle(true);
+            chip8.keystates = 0;
+
+            res &= ASSERT(chip8.profile.key_wait_cycles == 2);
+            res &= ASSERT(chip8.profile.self_jumps == 1);
+            res &= ASSERT(chip8.profile.pcs[0x200] == 3);
+            res &= ASSERT(chip8.profile.pcs[0x202] == 1);
+
+            END(res, os);
+        }
+#endif
+
+        {
+            SETUP("Trace Records");
+
+            Tracer::Record const record {123456789, 0x20A, 0xD015, 0x50, 0xF, 1};
+            uint8_t bytes[Tracer::RECORD_SIZE];
+            Tracer::encode(record, bytes);
+            Tracer::Record const decoded {Tracer::decode(bytes)};
+
+            res &= ASSERT(decoded.cycle == record.cycle);
+            res &= ASSERT(decoded.pc == record.pc);
+            res &= ASSERT(decoded.opcode == record.opcode);
+            res &= ASSERT(decoded.reg == record.reg);
+            res &= ASSERT(disassemble(0xD015) == "DRW V0, V1, 5");
+            res &= ASSERT(disassemble(0xF265) == "LD V2, [I]");
+            res &= ASSERT(disassemble(0x0123) == "DW 0x0123");
+
+            END(res, os);
+        }
+
+        {
+            SETUP("Quirk Profiles");
+
+            bool const shift {chip8.USE_LEGACY_SHIFT};
+            bool const load_store {chip8.USE_LEGACY_LOAD_STORE};
+
+            // The profile sets the flags to match
+            chip8.quirks = CHIP8::Quirks::SUPER_CHIP;
+            chip8.select_quirks();
+            res &= ASSERT(!chip8.USE_LEGACY_SHIFT);
+            res &= ASSERT(!chip8.USE_LEGACY_LOAD_STORE);
+
+            // And ignores them once picked
+            chip8.USE_LEGACY_SHIFT = true;
+            chip8.state.registers[1] = 0x6;
+            chip8.state.registers[2] = 0x81;
+            SET(chip8, 0x200, 0x8126);
+            chip8.state.pc = 0x200;
+            chip8.cycle(true);
+            res &= ASSERT(chip8.state.registers[1] == 0x3);
+            res &= ASSERT(chip8.state.registers[0xF] == 0x0);
+
+            chip8.quirks = CHIP8::Quirks::COSMAC_VIP;
+            chip8.select_quirks();
+            res &= ASSERT(chip8.USE_LEGACY_SHIFT);
+            chip8.state.registers[1] = 0x6;
+            chip8.state.pc = 0x200;
+            chip8.cycle(true);
+            res &= ASSERT(chip8.state.registers[1] == 0x40);
+            res &= ASSERT(chip8.state.registers[0xF] == 0x1);
+
+            chip8.quirks = CHIP8::Quirks::RUNTIME;
+            chip8.select_quirks();
+            chip8.USE_LEGACY_SHIFT = shift;
+            chip8.USE_LEGACY_LOAD_STORE = load_store;
+
+            END(res, os);
+        }
+
+        {
+            SETUP("Idle Loops");
+
+            // Wait for the delay timer, then for a key that never comes
+            SET(chip8, 0x200, 0x603C);
+            SET(chip8, 0x202, 0xF015);
+            SET(chip8, 0x204, 0xF107);
+            SET(chip8, 0x206, 0x3100);
+            SET(chip8, 0x208, 0x1204);
+            SET(chip8, 0x20A, 0xF20A);
+            chip8.state.pc = 0x200;
+            chip8.keystates = 0;
+
+            CHIP8 naive {chip8};
+            chip8.extra_cycles = 0;
+            chip8.resume();
+            chip8.run(5000);
+            chip8.pause();
+
+            for (int i {0}; i < 5000; i++) {
+                naive.cycle(true);
+            }
+
+            // Skipping leaves the machine exactly as running every cycle
+            std::vector<uint8_t> skipped(CHIP8::SERIALIZED_SIZE);
+            std::vector<uint8_t> stepped(CHIP8::SERIALIZED_SIZE);
+            CHIP8::serialize(chip8.state, skipped.data());
+            CHIP8::serialize(naive.state, stepped.data());
+            res &= ASSERT(skipped == stepped);
+            res &= ASSERT(chip8.state.pc == 0x20A);
+
+#ifndef CHIP8_PROFILE
+            if (chip8.engine != CHIP8::Engine::JIT) {
+                res &= ASSERT(chip8.extra_cycles > 0);
+            }
+#endif
+
+            END(res, os);
+        }
+
+        {
+            SETUP("Fused Instructions");
+
+            // Two loads the decoder fuses into one entry
+            SET(chip8, 0x200, 0x6005);
+            SET(chip8, 0x202, 0x6107);
+            SET(chip8, 0x204, 0x1204);
+            chip8.state.pc = 0x200;
+            chip8.resume();
+            chip8.run(2);
+
+            // Only the engines reading the decode cache fuse
+            if (chip8.engine == CHIP8::Engine::CACHED ||
+                chip8.engine == CHIP8::Engine::THREADED) {
+                res &= ASSERT(chip8.decode_cache[0x200].op ==
+                              CHIP8::Op::LD_VX_NN_LD_VY_NN);
+            }
+
+            res &= ASSERT(chip8.state.registers[1] == 0x07);
+            res &= ASSERT(chip8.state.pc == 0x204);
+
+            // Rewriting the second one backs the fusion out
+            uint8_t const load[] {0x61, 0x09};
+            chip8.write_memory(0x202, load, sizeof(load));
+            chip8.state.pc = 0x200;
+            chip8.run(2);
+            res &= ASSERT(chip8.state.registers[1] == 0x09);
+
+            // Landing on the second one runs only that
+            chip8.state.registers[0] = 0;
+            chip8.state.pc = 0x202;
+            chip8.run(1);
+            res &= ASSERT(chip8.state.registers[0] == 0);
+            res &= ASSERT(chip8.state.pc == 0x204);
+
+            // Never past the end of a run
+            chip8.state.pc = 0x200;
+            chip8.run(1);
+            res &= ASSERT(chip8.state.pc == 0x202);
+            chip8.pause();
+
+            END(res, os);
+        }
+
+        {
+            SETUP("AOT Blocks");
+
+            // A block as chip8-aot writes it, counting its runs
+            static int runs {0};
+            static AOTBlock const blocks[] {
+                {0x200, 2, [](AOT &m) {
+                     runs++;
+                     m.execute<AOT::Op::LD_VX_NN>(
+                         {AOT::Op::LD_VX_NN, 0x1, 0x0, 0x5, 0x05, 0x105});
+                     m.pc() = 0x204;
+                     m.execute<AOT::Op::ADD_VX_NN>(
+                         {AOT::Op::ADD_VX_NN, 0x1, 0x0, 0x1, 0x01, 0x101});
+                 }},
+            };
+
+            SET(chip8, 0x200, 0x6105);
+            SET(chip8, 0x202, 0x7101);
+            SET(chip8, 0x204, 0x1204);
+            AOT::attach(chip8, {"test", 0, blocks, std::size(blocks)});
+
+            CHIP8::Engine const engine {chip8.engine};
+            chip8.engine = CHIP8::Engine::AOT;
+            chip8.state.pc = 0x200;
+            chip8.resume();
+            chip8.run(3);
+            res &= ASSERT(chip8.state.registers[1] == 0x06);
+            res &= ASSERT(chip8.state.pc == 0x204);
+
+            // Written over, the interpreter runs it instead
+            SET(chip8, 0x202, 0x7102);
+            chip8.state.pc = 0x200;
+            chip8.run(2);
+            res &= ASSERT(chip8.state.registers[1] == 0x07);
+            chip8.pause();
+
+#ifndef CHIP8_PROFILE
+            res &= ASSERT(runs == 1);
+#endif
+
+            chip8.engine = engine;
+            chip8.aot_blocks.clear();
+            END(res, os);
+        }
+
+        {
+            SETUP("Rewind");
+
+            Rewind history {10, 4096, 4};
+            CHIP8::State state {};
+
+            // Record more frames than fit, spanning several keyframes
+            for (uint8_t frame {0}; frame < 12; frame++) {
+                chip8.state.registers[0] = frame;
+                chip8.save_state(state);
+                history.push(state);
+            }
+
+            res &= ASSERT(history.step_back(state));
+            res &= ASSERT(state.registers[0] == 10);
+            res &= ASSERT(history.step_back(state));
+            res &= ASSERT(state.registers[0] == 9);
+
+            END(res, os);
+        }
+
+        {
+            SETUP("Batch");
+
+            // V0 += 1, skip the jump back while V0 != V1
+            SET(chip8, 0x200, 0x7001);
+            SET(chip8, 0x202, 0x5010);
+            SET(chip8, 0x204, 0x1200);
+            SET(chip8, 0x206, 0x1206);
+            chip8.state.pc = 0x200;
+            chip8.state.registers[0] = 0;
+            chip8.state.registers[1] = 3;
+
+            CHIP8Batch batch {chip8, 4};
+            CHIP8::State state {};
+
+            // Different loop counts make the lanes diverge
+            for (size_t lane {0}; lane < batch.size(); lane++) {
+                batch.save_state(lane, state);
+                state.registers[1] = static_cast<uint8_t>(lane + 1);
+                batch.load_state(lane, state);
+            }
+
+            batch.run(20);
+
+            for (size_t lane {0}; lane < batch.size(); lane++) {
+                batch.save_state(lane, state);
+                res &= ASSERT(state.registers[0] == lane + 1);
+                res &= ASSERT(state.pc == 0x206);
+            }
+
+            res &= ASSERT(batch.divergent_cycles > 0);
+            res &= ASSERT(batch.owned_pages() == 0);
+
+            // Lanes share memory until they store to it, then get their
+            // own copy of the page written
+            SET(chip8, 0x200, 0xA300);
+            SET(chip8, 0x202, 0xF033);
+            SET(chip8, 0x204, 0x1204);
+            chip8.state.pc = 0x200;
+            chip8.state.registers[0] = 123;
+
+            CHIP8Batch stores {chip8, 4};
+            stores.save_state(2, state);
+            state.registers[0] = 45;
+            stores.load_state(2, state);
+            res &= ASSERT(stores.owned_pages() == 0);
+
+            stores.run(3);
+            res &= ASSERT(stores.owned_pages() == 4);
+            stores.save_state(0, state);
+            res &= ASSERT(state.memory[0x300] == 1 && state.memory[0x302] == 3);
+            stores.save_state(2, state);
+            res &= ASSERT(state.memory[0x301] == 4 && state.memory[0x302] == 5);
 
             END(res, os);
         }
@@ -0,0 +1,83 @@
+#include "chip8.h"
+#include <charconv>
+#include <string>
+#include <system_error>
+
+#pragma once
+
+// Command line helpers shared by the frontends
+
+// Whole argument as a number, false on anything else
+template <typename T>
+bool parse_number(std::string const& text, T &value, int const base = 10) {
+    char const *const end {text.data() + text.size()};
+    auto const [ptr, ec] {std::from_chars(text.data(), end, value, base)};
+    return ec == std::errc{} && ptr == end && !text.empty();
+}
+
+// Same for decimal fractions, like "0.5"
+inline bool parse_number(std::string const& text, double &value) {
+    char const *const end {text.data() + text.size()};
+    auto const [ptr, ec] {std::from_chars(text.data(), end, value)};
+    return ec == std::errc{} && ptr == end && !text.empty();
+}
+
+inline char const *const ENGINE_NAMES {
+    "switch, cached, threaded, jit, table, aot"};
+
+inline bool parse_engine(std::string const& name, CHIP8::Engine &engine) {
+    if (name == "switch") {
+        engine = CHIP8::Engine::SWITCH;
+    } else if (name == "cached") {
+        engine = CHIP8::Engine::CACHED;
+    } else if (name == "threaded") {
+        engine = CHIP8::Engine::THREADED;
+    } else if (name == "jit") {
+        engine = CHIP8::Engine::JIT;
+    } else if (name == "table") {
+        engine = CHIP8::Engine::TABLE;
+    } else if (name == "aot") {
+        engine = CHIP8::Engine::AOT;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+inline char const *engine_name(CHIP8::Engine const engine) {
+    switch (engine) {
+        case CHIP8::Engine::SWITCH:
+            return "switch";
+        case CHIP8::Engine::CACHED:
+            return "cached";
+        case CHIP8::Engine::THREADED:
+            return "threaded";
+        case CHIP8::Engine::JIT:
+            return "jit";
+        case CHIP8::Engine::TABLE:
+            return "table";
+        case CHIP8::Engine::AOT:
+            return "aot";
+    }
+
+    return "unknown";
+}
+
+inline char const *const QUIRKS_NAMES {"vip, chip48, schip, runtime"};
+
+inline bool parse_quirks(std::string const& name, CHIP8::Quirks &quirks) {
+    if (name == "vip") {
+        quirks = CHIP8::Quirks::COSMAC_VIP;
+    } else if (name == "chip48") {
+        quirks = CHIP8::Quirks::CHIP48;
+    } else if (name == "schip") {
+        quirks = CHIP8::Quirks::SUPER_CHIP;
+    } else if (name == "runtime") {
+        quirks = CHIP8::Quirks::RUNTIME;
+    } else {
+        return false;
+    }
+
+    return true;
+}
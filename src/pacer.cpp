@@ -0,0 +1,36 @@
+#include "pacer.h"
+#include <algorithm>
+
+FramePacer::FramePacer() : start{Clock::now()} {}
+
+int64_t FramePacer::due() {
+    auto const now {Clock::now()};
+
+    // Frames whose deadline has passed, counting the one at start
+    int64_t const target {(now - start) / Frames{1} + 1};
+    int64_t count {target - frame};
+
+    if (count > MAX_CATCH_UP) {
+        frame = target - MAX_CATCH_UP;
+        count = MAX_CATCH_UP;
+    }
+
+    frame += std::max<int64_t>(count, 0);
+    return std::max<int64_t>(count, 0);
+}
+
+FramePacer::Clock::duration FramePacer::until_next() const {
+    auto const next {start + Frames{frame}};
+    auto const now {Clock::now()};
+
+    if (next <= now) {
+        return Clock::duration::zero();
+    }
+
+    return std::chrono::duration_cast<Clock::duration>(next - now);
+}
+
+void FramePacer::reset() {
+    start = Clock::now();
+    frame = 0;
+}
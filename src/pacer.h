@@ -0,0 +1,34 @@
+#include <chrono>
+#include <cstdint>
+
+#pragma once
+
+// Keeps emulated frames in step with the wall clock at 60Hz.
+//
+// Frame k is due at start + k / 60 seconds on a monotonic clock. Deadlines
+// are computed from the start instead of added up, so rounding never
+// accumulates into drift.
+class FramePacer {
+public:
+    using Clock = std::chrono::steady_clock;
+    // Exactly one 60Hz frame
+    using Frames = std::chrono::duration<int64_t, std::ratio<1, 60>>;
+
+    // Further behind than this and the backlog is dropped instead of
+    // emulated in one burst, e.g. after the process was stopped
+    static int64_t constexpr MAX_CATCH_UP {4};
+
+    FramePacer();
+
+    // Number of frames due since the last call, at most MAX_CATCH_UP
+    int64_t due();
+    // Time left until the next frame is due, zero if it already is
+    Clock::duration until_next() const;
+
+    // Start over with the first frame due now
+    void reset();
+
+private:
+    Clock::time_point start;
+    int64_t frame {0};
+};
@@ -0,0 +1,128 @@
+#include "chip8.h"
+
+#ifdef CHIP8_PROFILE
+
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <iterator>
+#include <ostream>
+#include <vector>
+
+namespace {
+
+struct Hotspot {
+    uint16_t address;
+    uint64_t count;
+};
+
+std::vector<Hotspot> hotspots(CHIP8::Profile const& profile,
+                              size_t const limit) {
+    std::vector<Hotspot> list;
+
+    for (uint16_t address {0}; address < std::size(profile.pcs); address++) {
+        if (profile.pcs[address]) {
+            list.push_back({address, profile.pcs[address]});
+        }
+    }
+
+    // Ties go to the lower address, so reports are stable
+    std::sort(list.begin(), list.end(),
+              [](Hotspot const& a, Hotspot const& b) {
+                  return a.count != b.count ? a.count > b.count
+                                            : a.address < b.address;
+              });
+    list.resize(std::min(list.size(), limit));
+    return list;
+}
+
+uint64_t total(CHIP8::Profile const& profile) {
+    uint64_t sum {0};
+
+    for (uint64_t const count : profile.ops) {
+        sum += count;
+    }
+
+    return sum;
+}
+
+double share(uint64_t const count, uint64_t const sum) {
+    return sum ? 100.0 * count / sum : 0.0;
+}
+
+} // namespace
+
+void CHIP8::Profile::clear() {
+    *this = Profile{};
+}
+
+void CHIP8::Profile::report_text(std::ostream &os,
+                                 size_t const hotspots) const {
+    uint64_t const sum {total(*this)};
+    auto const flags {os.flags()};
+
+    os << "instructions " << sum << "\n\n";
+    os << "opcode         count       share\n";
+
+    for (size_t i {0}; i < OP_KINDS; i++) {
+        if (ops[i]) {
+            os << std::left << std::setw(14) << op_name(static_cast<Op>(i))
+               << " " << std::right << std::setw(11) << ops[i] << " "
+               << std::fixed << std::setprecision(2) << std::setw(6)
+               << share(ops[i], sum) << "%\n";
+        }
+    }
+
+    os << "\naddress        count       share\n";
+
+    for (Hotspot const& spot : ::hotspots(*this, hotspots)) {
+        os << "0x" << std::hex << std::setw(3) << std::setfill('0')
+           << spot.address << std::dec << std::setfill(' ') << "          "
+           << std::setw(11) << spot.count << " " << std::setw(6)
+           << share(spot.count, sum) << "%\n";
+    }
+
+    os << "\ndraws " << draws << ", " << draw_ns << " ns";
+
+    if (draws) {
+        os << ", " << draw_ns / draws << " ns per draw";
+    }
+
+    os << "\nkey wait cycles " << key_wait_cycles << "\n";
+    os << "self jumps " << self_jumps << "\n";
+    os.flags(flags);
+}
+
+void CHIP8::Profile::report_json(std::ostream &os,
+                                 size_t const hotspots) const {
+    os << "{\n  \"instructions\": " << total(*this) << ",\n  \"ops\": {";
+
+    bool first {true};
+
+    for (size_t i {0}; i < OP_KINDS; i++) {
+        if (ops[i]) {
+            os << (first ? "\n" : ",\n") << "    \""
+               << op_name(static_cast<Op>(i)) << "\": " << ops[i];
+            first = false;
+        }
+    }
+
+    os << "\n  },\n  \"hotspots\": [";
+    first = true;
+
+    for (Hotspot const& spot : ::hotspots(*this, hotspots)) {
+        char address[8];
+        std::snprintf(address, sizeof(address), "0x%03X", spot.address);
+        os << (first ? "\n" : ",\n") << "    {\"address\": \"" << address
+           << "\", \"count\": " << spot.count << "}";
+        first = false;
+    }
+
+    os << "\n  ],\n";
+    os << "  \"draws\": " << draws << ",\n";
+    os << "  \"draw_ns\": " << draw_ns << ",\n";
+    os << "  \"key_wait_cycles\": " << key_wait_cycles << ",\n";
+    os << "  \"self_jumps\": " << self_jumps << "\n}\n";
+}
+
+#endif
@@ -0,0 +1,227 @@
+#include "rewind.h"
+#include <cstring>
+
+namespace {
+
+size_t constexpr STATE_SIZE {sizeof(CHIP8::State)};
+// Zero runs shorter than this stay inside the literal around them
+size_t constexpr MIN_ZERO_RUN {4};
+
+void put_u16(uint8_t *&out, uint16_t const v) {
+    std::memcpy(out, &v, 2);
+    out += 2;
+}
+
+uint16_t get_u16(uint8_t const *&in) {
+    uint16_t v;
+    std::memcpy(&v, in, 2);
+    in += 2;
+    return v;
+}
+
+} // namespace
+
+Rewind::Rewind(size_t const max_frames, size_t const capacity,
+               size_t const keyframe_interval)
+    : keyframe_interval{keyframe_interval},
+      ring(capacity),
+      entries(max_frames),
+      // Skipped zero runs pay for their own header, only the first and
+      // last run can make the record bigger than the state
+      scratch(STATE_SIZE + 8) {}
+
+void Rewind::push(CHIP8::State const& state) {
+    if (entries.empty()) {
+        return;
+    }
+
+    static uint8_t const zero[STATE_SIZE] {};
+    bool const keyframe {count == 0 || since_keyframe >= keyframe_interval};
+
+    uint8_t const *const base {
+        keyframe ? zero : reinterpret_cast<uint8_t const *>(&current)};
+    size_t const size {encode(base, reinterpret_cast<uint8_t const *>(&state),
+                              scratch.data())};
+
+    // A record that can never fit means the ring is too small to be useful
+    if (size > ring.size()) {
+        clear();
+        return;
+    }
+
+    if (count == entries.size()) {
+        evict_oldest();
+    }
+
+    size_t const offset {allocate(size)};
+    std::memcpy(ring.data() + offset, scratch.data(), size);
+
+    // Eviction may have emptied the ring, so the record may now have to
+    // become a keyframe after all
+    if (!keyframe && count == 0) {
+        clear();
+        push(state);
+        return;
+    }
+
+    entries[(first + count) % entries.size()] = {offset, size, keyframe};
+    count++;
+    since_keyframe = keyframe ? 1 : since_keyframe + 1;
+    std::memcpy(static_cast<void *>(&current), &state, STATE_SIZE);
+}
+
+bool Rewind::step_back(CHIP8::State &out) {
+    if (count < 2) {
+        return false;
+    }
+
+    count--;
+
+    // Rebuild the new newest frame from the keyframe before it
+    size_t key {count - 1};
+
+    while (!entry(key).keyframe) {
+        key--;
+    }
+
+    uint8_t *const state {reinterpret_cast<uint8_t *>(&current)};
+    std::memset(state, 0, STATE_SIZE);
+
+    for (size_t i {key}; i < count; i++) {
+        Entry const& e {entry(i)};
+        apply(ring.data() + e.offset, e.size, state);
+    }
+
+    since_keyframe = count - key;
+    std::memcpy(static_cast<void *>(&out), state, STATE_SIZE);
+
+    return true;
+}
+
+size_t Rewind::frames() const {
+    return count;
+}
+
+size_t Rewind::size() const {
+    size_t total {0};
+
+    for (size_t i {0}; i < count; i++) {
+        total += entries[(first + i) % entries.size()].size;
+    }
+
+    return total;
+}
+
+size_t Rewind::memory_used() const {
+    return ring.size() + entries.size() * sizeof(Entry) + scratch.size() +
+           sizeof(*this);
+}
+
+void Rewind::clear() {
+    first = 0;
+    count = 0;
+    since_keyframe = 0;
+}
+
+Rewind::Entry &Rewind::entry(size_t const index) {
+    return entries[(first + index) % entries.size()];
+}
+
+size_t Rewind::allocate(size_t const size) {
+    while (count) {
+        Entry const& oldest {entry(0)};
+        Entry const& newest {entry(count - 1)};
+        size_t const end {newest.offset + newest.size};
+
+        if (newest.offset >= oldest.offset) {
+            // Used bytes are one block, free space on both sides
+            if (ring.size() - end >= size) {
+                return end;
+            }
+
+            if (oldest.offset >= size) {
+                return 0;
+            }
+        } else if (oldest.offset - end >= size) {
+            // Used bytes wrap around, free space is the gap between
+            return end;
+        }
+
+        evict_oldest();
+    }
+
+    return 0;
+}
+
+void Rewind::evict_oldest() {
+    // Deltas are useless without the keyframe before them
+    do {
+        first = (first + 1) % entries.size();
+        count--;
+    } while (count && !entry(0).keyframe);
+}
+
+size_t Rewind::encode(uint8_t const *base, uint8_t const *state,
+                      uint8_t *out) {
+    uint8_t *const start {out};
+    auto const x = [base, state](size_t const i) {
+        return base[i] ^ state[i];
+    };
+
+    size_t i {0};
+
+    while (i < STATE_SIZE) {
+        size_t zeros {0};
+
+        while (i + zeros < STATE_SIZE && x(i + zeros) == 0) {
+            zeros++;
+        }
+
+        i += zeros;
+
+        // Extend the literal until a zero run worth skipping
+        size_t end {i};
+
+        while (end < STATE_SIZE) {
+            if (x(end) != 0) {
+                end++;
+                continue;
+            }
+
+            size_t run {0};
+
+            while (end + run < STATE_SIZE && x(end + run) == 0) {
+                run++;
+            }
+
+            if (run >= MIN_ZERO_RUN || end + run == STATE_SIZE) {
+                break;
+            }
+
+            end += run;
+        }
+
+        put_u16(out, static_cast<uint16_t>(zeros));
+        put_u16(out, static_cast<uint16_t>(end - i));
+
+        for (; i < end; i++) {
+            *out++ = static_cast<uint8_t>(x(i));
+        }
+    }
+
+    return out - start;
+}
+
+void Rewind::apply(uint8_t const *in, size_t const size, uint8_t *state) {
+    uint8_t const *const end {in + size};
+    size_t pos {0};
+
+    while (in < end) {
+        pos += get_u16(in);
+        uint16_t const literal {get_u16(in)};
+
+        for (uint16_t i {0}; i < literal; i++) {
+            state[pos++] ^= *in++;
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#include "chip8.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#pragma once
+
+// Keeps the most recent frames of a machine in a fixed amount of memory.
+//
+// Every keyframe_interval frames the full state is stored, in between only
+// the XOR against the previous frame. Both are run length encoded, which
+// works well since memory is mostly zero and frames change little. When
+// the ring is full the oldest keyframe and its deltas are dropped.
+class Rewind {
+public:
+    // The defaults hold 60 seconds at 60Hz in well under 2 MB
+    explicit Rewind(size_t const max_frames = 60 * 60,
+                    size_t const capacity = 3 << 19,
+                    size_t const keyframe_interval = 60);
+
+    // Record the state of a new frame
+    void push(CHIP8::State const& state);
+    // Drop the newest frame and write the one before it to out. Returns
+    // false when there is nothing older to go back to.
+    bool step_back(CHIP8::State &out);
+
+    size_t frames() const;
+    // Bytes held by the encoded frames
+    size_t size() const;
+    // Bytes allocated up front, this never grows
+    size_t memory_used() const;
+
+    void clear();
+
+private:
+    struct Entry {
+        size_t offset;
+        size_t size;
+        bool keyframe;
+    };
+
+    size_t const keyframe_interval;
+
+    std::vector<uint8_t> ring;
+    // Entry ring, oldest at first
+    std::vector<Entry> entries;
+    size_t first {0};
+    size_t count {0};
+    size_t since_keyframe {0};
+
+    // Newest recorded state, deltas are taken against it
+    CHIP8::State current {};
+    std::vector<uint8_t> scratch;
+
+    Entry &entry(size_t const index);
+    size_t allocate(size_t const size);
+    void evict_oldest();
+
+    // Encodes base ^ state, returns the encoded size
+    size_t encode(uint8_t const *base, uint8_t const *state, uint8_t *out);
+    // Applies an encoded XOR in place
+    static void apply(uint8_t const *in, size_t const size, uint8_t *state);
+};
@@ -0,0 +1,313 @@
+#include "chip8.h"
+#include <algorithm>
+
+#pragma once
+
+// Opcode semantics, written once against a machine view so CHIP8 and
+// CHIP8Batch run exactly the same code. A view provides
+//
+//   V(i), pc(), I(), sp(), stack(i), delay_timer(), sound_timer()
+//       references to the registers
+//   row(y)                  reference to a row of the display buffer
+//   touch_rows(mask)        marks display buffer rows as drawn to
+//   memory(address)         byte of memory
+//   write_memory(a, src, n) store into memory
+//   keystates()             pressed keys, one bit per key
+//   rng(), vip_random()     references to the generator state
+//   cycles()                instructions executed
+//   random()                which generator RND uses
+//   legacy_jump(), legacy_shift(), legacy_index_add(), legacy_load_store()
+//       the quirk flags
+//
+// and is expected to inline away completely.
+template <CHIP8::Op OP, typename Machine>
+void CHIP8::execute(Machine &&m, Instr const& in) {
+    switch (OP) {
+        // Clear the screen
+        case Op::CLS:
+            for (int y {0}; y < DISPLAY_HEIGHT; y++) {
+                m.row(y) = 0;
+            }
+            m.touch_rows(~uint32_t{0});
+            break;
+
+        // Return from subroutine
+        case Op::RET:
+            m.sp() = (m.sp() - 1) & 0xF;
+            m.pc() = m.stack(m.sp());
+            break;
+
+        // Jump
+        case Op::JP:
+            m.pc() = in.NNN;
+            break;
+
+        case Op::JP_V0:
+            if (m.legacy_jump()) {
+                m.pc() = m.V(0x0) + in.NNN;
+            } else {
+                m.pc() = m.V(in.X) + in.NNN;
+            }
+            break;
+
+        // Call Subroutine
+        case Op::CALL:
+            m.stack(m.sp()) = m.pc();
+            m.sp() = (m.sp() + 1) & 0xF;
+            m.pc() = in.NNN;
+            break;
+
+        // Skip if Equal
+        case Op::SE_VX_NN:
+            m.pc() += 2 * (m.V(in.X) == in.NN);
+            break;
+
+        // Skip if not Equal
+        case Op::SNE_VX_NN:
+            m.pc() += 2 * (m.V(in.X) != in.NN);
+            break;
+
+        // Skip if registers are Equal
+        case Op::SE_VX_VY:
+            m.pc() += 2 * (m.V(in.X) == m.V(in.Y));
+            break;
+
+        // Skip if registers are not Equal
+        case Op::SNE_VX_VY:
+            m.pc() += 2 * (m.V(in.X) != m.V(in.Y));
+            break;
+
+        //  Set
+        case Op::LD_VX_NN:
+            m.V(in.X) = in.NN;
+            break;
+
+        // Add
+        case Op::ADD_VX_NN:
+            m.V(in.X) += in.NN;
+            break;
+
+        // Set Index Register
+        case Op::LD_I:
+            m.I() = in.NNN;
+            break;
+
+        // Draw
+        case Op::DRW: {
+            uint8_t const x_reg{
+                static_cast<uint8_t>(m.V(in.X) % DISPLAY_WIDTH)};
+            uint8_t const y_reg{
+                static_cast<uint8_t>(m.V(in.Y) % DISPLAY_HEIGHT)};
+            uint64_t collision {0};
+            uint32_t touched {0};
+
+            // Rows past the bottom of the display are clipped
+            int const rows {std::min<int>(in.N, DISPLAY_HEIGHT - y_reg)};
+
+            for (int i{0}; i < rows; i++) {
+                // Line the sprite up with the row, shifting right also
+                // drops the pixels past the right edge
+                uint64_t const sprite {
+                    (static_cast<uint64_t>(m.memory((m.I() + i) & 0x0FFF))
+                     << (DISPLAY_WIDTH - SPRITE_WIDTH)) >> x_reg
+                };
+                uint64_t &row {m.row(y_reg + i)};
+
+                collision |= row & sprite;
+                row ^= sprite;
+                touched |= uint32_t{sprite != 0} << (y_reg + i);
+            }
+
+            m.touch_rows(touched);
+            m.V(0xF) = collision != 0;
+            break;
+        }
+
+        // Random
+        case Op::RND: {
+            uint8_t rand;
+
+            if (m.random() == Random::VIP) {
+                // The VIP indexed its own interpreter page, the closest
+                // thing here is the program page
+                m.vip_random() += m.memory(0x200 | (m.cycles() & 0xFF));
+                rand = m.vip_random();
+            } else {
+                rand = static_cast<uint8_t>(next_random(m.rng()) >> 24);
+            }
+
+            m.V(in.X) = rand & in.NN;
+
+            break;
+        }
+
+        // Set
+        case Op::LD_VX_VY:
+            m.V(in.X) = m.V(in.Y);
+            break;
+
+        // Binary OR
+        case Op::OR:
+            m.V(in.X) = m.V(in.X) | m.V(in.Y);
+            m.V(0xF) = 0;
+            break;
+
+        // Binary AND
+        case Op::AND:
+            m.V(in.X) = m.V(in.X) & m.V(in.Y);
+            m.V(0xF) = 0;
+            break;
+
+        // Logical XOR
+        case Op::XOR:
+            m.V(in.X) = m.V(in.X) ^ m.V(in.Y);
+            m.V(0xF) = 0;
+            break;
+
+        // Add
+        case Op::ADD_VX_VY:
+            m.V(in.X) = m.V(in.X) + m.V(in.Y);
+            // If the sum is smaller than the operand, overflow occured
+            m.V(0xF) = m.V(in.X) < m.V(in.Y);
+            break;
+
+        // Subtract X-Y
+        case Op::SUB: {
+            bool const carry {m.V(in.Y) > m.V(in.X)};
+            m.V(in.X) = m.V(in.X) - m.V(in.Y);
+            m.V(0xF) = !carry;
+            break;
+        }
+
+        // Subtract Y-X
+        case Op::SUBN: {
+            bool const carry {m.V(in.X) > m.V(in.Y)};
+            m.V(in.X) = m.V(in.Y) - m.V(in.X);
+            m.V(0xF) = !carry;
+            break;
+        }
+
+        // Shift Right
+        case Op::SHR: {
+            if (m.legacy_shift()) {
+                m.V(in.X) = m.V(in.Y);
+            }
+            // fuck brace initialization, I know this cast is fine
+            // I don't need to tell you that im not stupid, compiler
+            uint8_t const carry = m.V(in.X) & 0x01;
+            m.V(in.X) >>= 0x1;
+            m.V(0xF) = carry;
+            break;
+        }
+
+        // Shift Left
+        case Op::SHL: {
+            if (m.legacy_shift()) {
+                m.V(in.X) = m.V(in.Y);
+            }
+            // looking at you g++
+            uint8_t const carry = (m.V(in.X) & 0x80) >> 7;
+            m.V(in.X) <<= 0x1;
+            m.V(0xF) = carry;
+            break;
+        }
+
+        // Skip if key in X is pressed
+        case Op::SKP:
+            m.pc() += 2 * ((m.keystates() & (0x1 << m.V(in.X))) != 0);
+            break;
+
+        // Skip if key in X is not pressed
+        case Op::SKNP:
+            m.pc() += 2 * ((m.keystates() & (0x1 << m.V(in.X))) == 0);
+            break;
+
+        // Set X to Delay Timer
+        case Op::LD_VX_DT:
+            m.V(in.X) = m.delay_timer();
+            break;
+
+        // Set the Delay Timer to X
+        case Op::LD_DT_VX:
+            m.delay_timer() = m.V(in.X);
+            break;
+
+        // Set the Sound Timer to X
+        case Op::LD_ST_VX:
+            m.sound_timer() = m.V(in.X);
+            break;
+
+        // Add X to Index
+        case Op::ADD_I_VX:
+            m.I() += m.V(in.X);
+
+            if (m.legacy_index_add())
+                // Set overflow flag
+                m.V(0xF) = m.I() < m.V(in.X);
+            break;
+
+        // Get key (block until a key is pressed)
+        case Op::LD_VX_K:
+            if (m.keystates()) {
+                // Set X to the first key pressed that is found
+                for (int i {}; i < 16; i++) {
+                    if (m.keystates() & (0x1 << i)) {
+                        m.V(in.X) = i;
+                        break;
+                    }
+                }
+
+            } else {
+                m.pc() -= 2;
+            }
+            break;
+
+        // Font character
+        case Op::LD_F_VX:
+            m.I() = 0x0050 + 5 * m.V(in.X);
+            break;
+
+        // Binary coded decimal conversion
+        case Op::LD_B_VX: {
+            uint8_t const num {m.V(in.X)};
+            uint8_t const digits[3] {
+                static_cast<uint8_t>(num / 100),
+                static_cast<uint8_t>((num % 100) / 10),
+                static_cast<uint8_t>(num % 10),
+            };
+            m.write_memory(m.I(), digits, 3);
+            break;
+        }
+
+        // Store memory
+        case Op::LD_I_VX: {
+            uint8_t values[16];
+
+            for (int i {0}; i <= in.X; i++) {
+                values[i] = m.V(i);
+            }
+
+            m.write_memory(m.I(), values, in.X + 1);
+            m.I() += (in.X + 1) * m.legacy_load_store();
+            break;
+        }
+
+        // Load memory
+        case Op::LD_VX_I:
+            for (int i {0}; i <= in.X; i++) {
+                m.V(i) = m.memory((m.I() + i) & 0x0FFF);
+            }
+            m.I() += (in.X + 1) * m.legacy_load_store();
+            break;
+
+        // Fused sequences run their parts through here one by one
+        case Op::LD_I_DRW:
+        case Op::LD_VX_NN_LD_VY_NN:
+        case Op::ADD_SE_JP:
+        case Op::LD_I_LD_VX_I:
+        case Op::UNDECODED:
+        case Op::NOP:
+        case Op::COUNT:
+            break;
+    }
+}
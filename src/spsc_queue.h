@@ -0,0 +1,66 @@
+#include <atomic>
+#include <cstddef>
+
+#pragma once
+
+// Fixed size ring for one producer thread and one consumer thread.
+// Neither side locks or waits, push fails when the ring is full.
+template <typename T, size_t N>
+class SPSCQueue {
+public:
+    static_assert(N && (N & (N - 1)) == 0, "N must be a power of two");
+
+    SPSCQueue() = default;
+
+    // Copies are taken while neither side is running
+    SPSCQueue(SPSCQueue const& other) {
+        *this = other;
+    }
+
+    SPSCQueue& operator=(SPSCQueue const& other) {
+        for (size_t i {0}; i < N; i++) {
+            slots[i] = other.slots[i];
+        }
+
+        head.store(other.head.load(std::memory_order_relaxed),
+                   std::memory_order_relaxed);
+        tail.store(other.tail.load(std::memory_order_relaxed),
+                   std::memory_order_relaxed);
+        return *this;
+    }
+
+    // Producer side
+    bool push(T const& value) {
+        size_t const t {tail.load(std::memory_order_relaxed)};
+
+        if (t - head.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+
+        slots[t & (N - 1)] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, front() is null when the queue is empty
+    T const *front() const {
+        size_t const h {head.load(std::memory_order_relaxed)};
+
+        if (h == tail.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+
+        return &slots[h & (N - 1)];
+    }
+
+    void pop() {
+        head.store(head.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+    }
+
+private:
+    T slots[N] {};
+    // Written by the consumer and the producer, on separate cache lines
+    alignas(64) std::atomic<size_t> head {0};
+    alignas(64) std::atomic<size_t> tail {0};
+};
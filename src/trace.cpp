@@ -0,0 +1,196 @@
+#include "trace.h"
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+uint8_t constexpr TRACE_MAGIC[4] {'C', '8', 'T', 'R'};
+uint16_t constexpr TRACE_VERSION {1};
+
+// Records written per fwrite
+size_t constexpr BATCH {4096};
+
+void put16(uint8_t *out, uint16_t const v) {
+    out[0] = v & 0xFF;
+    out[1] = v >> 8;
+}
+
+uint16_t get16(uint8_t const *in) {
+    return static_cast<uint16_t>(in[0] | in[1] << 8);
+}
+
+} // namespace
+
+Tracer::Tracer(std::string const& path) : file{std::fopen(path.c_str(), "wb")} {
+    if (!file) {
+        return;
+    }
+
+    uint8_t header[HEADER_SIZE];
+    encode_header(header);
+    std::fwrite(header, 1, sizeof(header), file);
+
+    writer = std::thread{[this] { drain(); }};
+}
+
+Tracer::~Tracer() {
+    stopping = true;
+
+    if (writer.joinable()) {
+        writer.join();
+    }
+
+    if (file) {
+        std::fclose(file);
+    }
+}
+
+bool Tracer::ok() const {
+    return file != nullptr;
+}
+
+uint64_t Tracer::dropped() const {
+    return dropped_records.load(std::memory_order_relaxed);
+}
+
+void Tracer::drain() {
+    std::vector<uint8_t> buffer(BATCH * RECORD_SIZE);
+
+    while (true) {
+        // Read the flag first, so nothing pushed before it was set is left
+        bool const last {stopping};
+        size_t count {0};
+        bool idle {true};
+
+        for (Record const *record {ring.front()}; record;
+             record = ring.front()) {
+            encode(*record, &buffer[count * RECORD_SIZE]);
+            ring.pop();
+            idle = false;
+
+            if (++count == BATCH) {
+                std::fwrite(buffer.data(), RECORD_SIZE, count, file);
+                count = 0;
+            }
+        }
+
+        std::fwrite(buffer.data(), RECORD_SIZE, count, file);
+
+        if (last) {
+            return;
+        }
+
+        // Only rest once the machine stopped producing
+        if (idle) {
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+    }
+}
+
+void Tracer::encode_header(uint8_t *out) {
+    std::memcpy(out, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    put16(out + 4, TRACE_VERSION);
+    put16(out + 6, RECORD_SIZE);
+}
+
+bool Tracer::decode_header(uint8_t const *in, size_t const size) {
+    return size >= HEADER_SIZE &&
+           std::memcmp(in, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0 &&
+           get16(in + 4) == TRACE_VERSION && get16(in + 6) == RECORD_SIZE;
+}
+
+void Tracer::encode(Record const& record, uint8_t *out) {
+    for (int i {0}; i < 8; i++) {
+        out[i] = static_cast<uint8_t>(record.cycle >> (8 * i));
+    }
+
+    put16(out + 8, record.pc);
+    put16(out + 10, record.opcode);
+    put16(out + 12, record.I);
+    out[14] = record.reg;
+    out[15] = record.value;
+}
+
+Tracer::Record Tracer::decode(uint8_t const *in) {
+    Record record {};
+
+    for (int i {0}; i < 8; i++) {
+        record.cycle |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+
+    record.pc = get16(in + 8);
+    record.opcode = get16(in + 10);
+    record.I = get16(in + 12);
+    record.reg = in[14];
+    record.value = in[15];
+    return record;
+}
+
+std::string disassemble(uint16_t const op) {
+    unsigned const X {(op >> 8) & 0xFu};
+    unsigned const Y {(op >> 4) & 0xFu};
+    unsigned const N {op & 0xFu};
+    unsigned const NN {op & 0xFFu};
+    unsigned const NNN {op & 0xFFFu};
+    char text[32];
+
+    auto const format = [&text](char const *fmt, auto... args) {
+        std::snprintf(text, sizeof(text), fmt, args...);
+        return std::string{text};
+    };
+
+    switch (op & 0xF000) {
+        case 0x0000:
+            if (op == 0x00E0) return "CLS";
+            if (op == 0x00EE) return "RET";
+            break;
+        case 0x1000: return format("JP 0x%03X", NNN);
+        case 0x2000: return format("CALL 0x%03X", NNN);
+        case 0x3000: return format("SE V%X, 0x%02X", X, NN);
+        case 0x4000: return format("SNE V%X, 0x%02X", X, NN);
+        case 0x5000: return format("SE V%X, V%X", X, Y);
+        case 0x6000: return format("LD V%X, 0x%02X", X, NN);
+        case 0x7000: return format("ADD V%X, 0x%02X", X, NN);
+        case 0x9000: return format("SNE V%X, V%X", X, Y);
+        case 0xA000: return format("LD I, 0x%03X", NNN);
+        case 0xB000: return format("JP V0, 0x%03X", NNN);
+        case 0xC000: return format("RND V%X, 0x%02X", X, NN);
+        case 0xD000: return format("DRW V%X, V%X, %u", X, Y, N);
+
+        case 0x8000:
+            switch (N) {
+                case 0x0: return format("LD V%X, V%X", X, Y);
+                case 0x1: return format("OR V%X, V%X", X, Y);
+                case 0x2: return format("AND V%X, V%X", X, Y);
+                case 0x3: return format("XOR V%X, V%X", X, Y);
+                case 0x4: return format("ADD V%X, V%X", X, Y);
+                case 0x5: return format("SUB V%X, V%X", X, Y);
+                case 0x6: return format("SHR V%X, V%X", X, Y);
+                case 0x7: return format("SUBN V%X, V%X", X, Y);
+                case 0xE: return format("SHL V%X, V%X", X, Y);
+            }
+            break;
+
+        case 0xE000:
+            if (NN == 0x9E) return format("SKP V%X", X);
+            if (NN == 0xA1) return format("SKNP V%X", X);
+            break;
+
+        case 0xF000:
+            switch (NN) {
+                case 0x07: return format("LD V%X, DT", X);
+                case 0x0A: return format("LD V%X, K", X);
+                case 0x15: return format("LD DT, V%X", X);
+                case 0x18: return format("LD ST, V%X", X);
+                case 0x1E: return format("ADD I, V%X", X);
+                case 0x29: return format("LD F, V%X", X);
+                case 0x33: return format("LD B, V%X", X);
+                case 0x55: return format("LD [I], V%X", X);
+                case 0x65: return format("LD V%X, [I]", X);
+            }
+            break;
+    }
+
+    return format("DW 0x%04X", static_cast<unsigned>(op));
+}
@@ -0,0 +1,71 @@
+#include "spsc_queue.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#pragma once
+
+// Writes executed instructions to a file without slowing the machine down.
+//
+// The machine pushes fixed size records into a lock-free ring, a thread of
+// the tracer's own drains it to disk. When the disk cannot keep up, records
+// are dropped rather than making the machine wait; the cycle numbers show
+// where. Decode the file with chip8-trace.
+class Tracer {
+public:
+    struct Record {
+        uint64_t cycle;
+        // Address and opcode of the instruction
+        uint16_t pc;
+        uint16_t opcode;
+        // Index register after the instruction
+        uint16_t I;
+        // Register the instruction changed and its new value, the highest
+        // one when several were
+        uint8_t reg;
+        uint8_t value;
+    };
+
+    static uint8_t constexpr NO_REGISTER {0xFF};
+    // Bytes per record in the file
+    static size_t constexpr RECORD_SIZE {16};
+
+    explicit Tracer(std::string const& path);
+    ~Tracer();
+    Tracer(Tracer const&) = delete;
+    Tracer& operator=(Tracer const&) = delete;
+
+    // False if the file could not be created
+    bool ok() const;
+
+    // Called by the machine, never waits
+    void record(Record const& record) {
+        if (!ring.push(record)) {
+            dropped_records.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t dropped() const;
+
+    // Versioned file header, decode returns false if it is not a trace
+    static void encode_header(uint8_t *out);
+    static bool decode_header(uint8_t const *in, size_t const size);
+    static size_t constexpr HEADER_SIZE {4 + 2 + 2};
+
+    static void encode(Record const& record, uint8_t *out);
+    static Record decode(uint8_t const *in);
+
+private:
+    SPSCQueue<Record, 1 << 16> ring {};
+    std::atomic<uint64_t> dropped_records {0};
+    std::atomic<bool> stopping {false};
+    std::FILE *file {nullptr};
+    std::thread writer {};
+
+    void drain();
+};
+
+// Assembly for an opcode, like "LD V1, 0x2A" or "DRW V0, V1, 5"
+std::string disassemble(uint16_t const opcode);
@@ -0,0 +1,100 @@
+#include "options.h"
+#include "trace.h"
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Prints a trace written by Tracer as one line per instruction:
+//
+//   cycle        pc   opcode  disassembly        I      change
+//          1203  0x20A  D015    DRW V0, V1, 5      I=050  VF=00
+//
+// Cycles missing from the trace, dropped or skipped, show up as gaps.
+
+namespace {
+
+void usage(char const *name) {
+    std::cerr << "Usage: " << name << " <trace> [--from CYCLE] [--count N]"
+              << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    if (argc <= 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    uint64_t from {0};
+    uint64_t count {UINT64_MAX};
+
+    for (int i {2}; i < argc; i++) {
+        std::string const arg {argv[i]};
+
+        if (arg == "--from" && i + 1 < argc &&
+            parse_number(argv[i + 1], from)) {
+            i++;
+        } else if (arg == "--count" && i + 1 < argc &&
+                   parse_number(argv[i + 1], count)) {
+            i++;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::ifstream ifs(argv[1], std::ios::binary);
+    uint8_t header[Tracer::HEADER_SIZE];
+
+    if (!ifs.read(reinterpret_cast<char *>(header), sizeof(header)) ||
+        !Tracer::decode_header(header, sizeof(header))) {
+        std::cerr << "Not a trace file: " << argv[1] << std::endl;
+        return 1;
+    }
+
+    uint8_t bytes[Tracer::RECORD_SIZE];
+    uint64_t expected {0};
+    uint64_t printed {0};
+    uint64_t missing {0};
+
+    while (printed < count &&
+           ifs.read(reinterpret_cast<char *>(bytes), sizeof(bytes))) {
+        Tracer::Record const record {Tracer::decode(bytes)};
+
+        if (record.cycle < from) {
+            expected = record.cycle + 1;
+            continue;
+        }
+
+        if (expected && record.cycle != expected) {
+            std::printf("-- %lld cycles missing --\n",
+                        static_cast<long long>(record.cycle - expected));
+            missing += record.cycle - expected;
+        }
+
+        expected = record.cycle + 1;
+
+        std::printf("%14llu  0x%03X  %04X    %-18s I=%03X",
+                    static_cast<unsigned long long>(record.cycle), record.pc,
+                    record.opcode, disassemble(record.opcode).c_str(),
+                    record.I);
+
+        if (record.reg != Tracer::NO_REGISTER) {
+            std::printf("  V%X=%02X", record.reg, record.value);
+        }
+
+        std::printf("\n");
+        printed++;
+    }
+
+    if (missing) {
+        std::fprintf(stderr, "%llu cycles missing from the trace\n",
+                     static_cast<unsigned long long>(missing));
+    }
+
+    return 0;
+}
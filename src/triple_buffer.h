@@ -0,0 +1,73 @@
+#include <atomic>
+#include <cstdint>
+
+#pragma once
+
+// Hands the latest value from one producer thread to one consumer thread
+// without either of them ever waiting.
+//
+// The producer fills back() and publishes it, the consumer acquires the
+// newest published value and reads front(). The three slots rotate through
+// an atomic index, so each side only ever touches a slot it owns. Values
+// published faster than they are acquired are dropped, the consumer always
+// sees the latest.
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() = default;
+
+    // Copies are taken while neither side is running
+    TripleBuffer(TripleBuffer const& other)
+        : slots{other.slots[0], other.slots[1], other.slots[2]},
+          back_index{other.back_index},
+          front_index{other.front_index},
+          middle{other.middle.load(std::memory_order_relaxed)} {}
+
+    TripleBuffer& operator=(TripleBuffer const& other) {
+        for (int i {0}; i < 3; i++) {
+            slots[i] = other.slots[i];
+        }
+
+        back_index = other.back_index;
+        front_index = other.front_index;
+        middle.store(other.middle.load(std::memory_order_relaxed),
+                     std::memory_order_relaxed);
+        return *this;
+    }
+
+    // Producer side
+    T &back() {
+        return slots[back_index];
+    }
+
+    void publish() {
+        back_index = middle.exchange(back_index | FRESH,
+                                     std::memory_order_acq_rel) & INDEX;
+    }
+
+    // Consumer side. Returns false if nothing was published since the
+    // last call, front() then still holds the previous value.
+    bool acquire() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+            return false;
+        }
+
+        front_index = middle.exchange(front_index,
+                                      std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    T const& front() const {
+        return slots[front_index];
+    }
+
+private:
+    static uint8_t constexpr INDEX {0x3};
+    // Set while the middle slot holds a value the consumer has not seen
+    static uint8_t constexpr FRESH {0x4};
+
+    T slots[3] {};
+    uint8_t back_index {0};
+    uint8_t front_index {1};
+    std::atomic<uint8_t> middle {2};
+};